@@ -7,11 +7,24 @@
 #include <time.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <thread>            // step a strisce su un pool di thread
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "../Common/rng.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CA_SIMD 1               // AVX2 con scelta a runtime
+#include <immintrin.h>
+#endif
 
 // ====== Parametri griglia ======
-#define W 200
-#define H 140
-static unsigned char g[H][W], nxt[H][W], age[H][W];
+// Dimensioni scelte all'avvio (-w N -h N), fino a MAX_SIDE per lato.
+#define MAX_SIDE 16384
+static int W=200, H=140;
 
 // ====== Vista (camera 2D) ======
 static int winW=1200, winH=800;
@@ -24,59 +37,412 @@ static int autoplay=0, timerMs=70, showGrid=1;
 static int seedPct=35;         // % iniziale di celle vive (roccia)
 static int BIRTH_N=4;          // parametro Birth
 static int DEATH_N=3;          // parametro Death
+static int nThreads=0;         // thread per lo step (0 = tutti i core, -t N)
 
 // ---- Utils ----
 static inline int clampi(int v,int a,int b){ return v<a?a:(v>b?b:v); }
 static inline float clampf(float v,float a,float b){ return v<a?a:(v>b?b:v); }
 
-// ---- Conteggio vicini (Moore 8) ----
-static inline int nbors(int r,int c){
-    int s=0;
-    for(int dr=-1; dr<=1; ++dr){
-        for(int dc=-1; dc<=1; ++dc){
-            if(!dr && !dc) continue;
-            int rr=r+dr, cc=c+dc;
-            if(rr>=0 && rr<H && cc>=0 && cc<W) s += g[rr][cc];
+// ====== Motore a bit: 64 celle per parola ======
+// La cella (r,c) e' il bit c%64 della parola 1+c/64 della riga r+1 (passo WS).
+// Attorno alla griglia c'e' una cornice di parole sempre a zero (righe 0 e
+// H+1, colonne 0 e WW+1), cosi' i vicini fuori bordo valgono 0.
+#define MAX_WS (MAX_SIDE/64+2)
+static int WW, WS;              // parole per riga, passo di riga con la cornice
+static uint64_t TAIL;           // bit validi dell'ultima parola
+static std::vector<uint64_t> bitsA, bitsB;
+static uint64_t *cur, *nx;
+#define ROW(b,r) ((b)+(size_t)(r)*WS)
+
+static inline int cellBit(int r,int c){ return (int)(ROW(cur,r+1)[1+(c>>6)] >> (c&63)) & 1; }
+
+// Sommatori "bit-sliced": ogni bit di una parola e' una cella diversa, quindi
+// 64 conteggi a 4 bit (s3 s2 s1 s0) escono da una manciata di AND/XOR.
+static inline void caCount(const uint64_t* up,const uint64_t* mid,const uint64_t* dn,uint64_t s[4]){
+    uint64_t uL=(up[0]<<1)|(up[-1]>>63),  uR=(up[0]>>1)|(up[1]<<63);
+    uint64_t mL=(mid[0]<<1)|(mid[-1]>>63), mR=(mid[0]>>1)|(mid[1]<<63);
+    uint64_t dL=(dn[0]<<1)|(dn[-1]>>63),  dR=(dn[0]>>1)|(dn[1]<<63);
+    uint64_t x;
+    // riga sopra, riga sotto (0..3) e i due di lato (0..2)
+    x=uL^up[0]; uint64_t a0=x^uR, a1=(uL&up[0])|(uR&x);
+    x=dL^dn[0]; uint64_t b0=x^dR, b1=(dL&dn[0])|(dR&x);
+    uint64_t c0=mL^mR, c1=mL&mR;
+    // somma a 4 bit (max 8)
+    x=a0^b0; uint64_t s0=x^c0, k1=(a0&b0)|(c0&x);
+    x=a1^b1; uint64_t t0=x^c1, t1=(a1&b1)|(c1&x);
+    uint64_t k2=t0&k1;
+    s[0]=s0; s[1]=t0^k1; s[2]=t1^k2; s[3]=t1&k2;
+}
+
+// kb[0..3] = bit di BIRTH_N, kb[4..7] = bit di DEATH_N, ognuno 0 o ~0.
+static inline uint64_t caWord(const uint64_t* up,const uint64_t* mid,const uint64_t* dn,const uint64_t* kb){
+    uint64_t s[4];
+    caCount(up,mid,dn,s);
+    // n==BIRTH_N e n==DEATH_N senza confronti
+    uint64_t eqB=~((s[0]^kb[0])|(s[1]^kb[1])|(s[2]^kb[2])|(s[3]^kb[3]));
+    uint64_t eqD=~((s[0]^kb[4])|(s[1]^kb[5])|(s[2]^kb[6])|(s[3]^kb[7]));
+    return (eqB & ~mid[0]) | (~eqD & mid[0]);
+}
+
+// parole w0..w1 di una riga
+static void caRowScalar(uint64_t* out,const uint64_t* up,const uint64_t* mid,const uint64_t* dn,const uint64_t* kb,int w0,int w1){
+    for(int w=w0; w<=w1; ++w) out[w]=caWord(up+w, mid+w, dn+w, kb);
+}
+
+#ifdef CA_SIMD
+// stesso conto di caWord() su 4 parole (256 celle) alla volta
+__attribute__((target("avx2")))
+static void caRowAvx2(uint64_t* out,const uint64_t* up,const uint64_t* mid,const uint64_t* dn,const uint64_t* kb,int w0,int w1){
+    __m256i B0=_mm256_set1_epi64x((long long)kb[0]), B1=_mm256_set1_epi64x((long long)kb[1]);
+    __m256i B2=_mm256_set1_epi64x((long long)kb[2]), B3=_mm256_set1_epi64x((long long)kb[3]);
+    __m256i D0=_mm256_set1_epi64x((long long)kb[4]), D1=_mm256_set1_epi64x((long long)kb[5]);
+    __m256i D2=_mm256_set1_epi64x((long long)kb[6]), D3=_mm256_set1_epi64x((long long)kb[7]);
+    int w=w0;
+    for(; w+3<=w1; w+=4){
+        #define CA_LD(p,o) _mm256_loadu_si256((const __m256i*)((p)+w+(o)))
+        #define CA_SH(p,L,C,R) __m256i C=CA_LD(p,0); \
+            __m256i L=_mm256_or_si256(_mm256_slli_epi64(C,1), _mm256_srli_epi64(CA_LD(p,-1),63)); \
+            __m256i R=_mm256_or_si256(_mm256_srli_epi64(C,1), _mm256_slli_epi64(CA_LD(p,1),63));
+        CA_SH(up,uL,u,uR) CA_SH(mid,mL,m,mR) CA_SH(dn,dL,d,dR)
+        #undef CA_SH
+        #undef CA_LD
+        __m256i x;
+        x=_mm256_xor_si256(uL,u);
+        __m256i a0=_mm256_xor_si256(x,uR), a1=_mm256_or_si256(_mm256_and_si256(uL,u),_mm256_and_si256(uR,x));
+        x=_mm256_xor_si256(dL,d);
+        __m256i b0=_mm256_xor_si256(x,dR), b1=_mm256_or_si256(_mm256_and_si256(dL,d),_mm256_and_si256(dR,x));
+        __m256i c0=_mm256_xor_si256(mL,mR), c1=_mm256_and_si256(mL,mR);
+        x=_mm256_xor_si256(a0,b0);
+        __m256i s0=_mm256_xor_si256(x,c0), k1=_mm256_or_si256(_mm256_and_si256(a0,b0),_mm256_and_si256(c0,x));
+        x=_mm256_xor_si256(a1,b1);
+        __m256i t0=_mm256_xor_si256(x,c1), t1=_mm256_or_si256(_mm256_and_si256(a1,b1),_mm256_and_si256(c1,x));
+        __m256i s1=_mm256_xor_si256(t0,k1), k2=_mm256_and_si256(t0,k1);
+        __m256i s2=_mm256_xor_si256(t1,k2), s3=_mm256_and_si256(t1,k2);
+        // ~eq: basta un bit diverso
+        __m256i neB=_mm256_or_si256(_mm256_or_si256(_mm256_xor_si256(s0,B0),_mm256_xor_si256(s1,B1)),
+                                    _mm256_or_si256(_mm256_xor_si256(s2,B2),_mm256_xor_si256(s3,B3)));
+        __m256i neD=_mm256_or_si256(_mm256_or_si256(_mm256_xor_si256(s0,D0),_mm256_xor_si256(s1,D1)),
+                                    _mm256_or_si256(_mm256_xor_si256(s2,D2),_mm256_xor_si256(s3,D3)));
+        __m256i v=_mm256_or_si256(_mm256_andnot_si256(_mm256_or_si256(neB,m),_mm256_set1_epi64x(-1)),
+                                  _mm256_and_si256(neD,m));
+        _mm256_storeu_si256((__m256i*)(out+w), v);
+    }
+    for(; w<=w1; ++w) out[w]=caWord(up+w, mid+w, dn+w, kb);
+}
+#endif
+
+typedef void (*CaRow)(uint64_t*,const uint64_t*,const uint64_t*,const uint64_t*,const uint64_t*,int,int);
+
+static CaRow caRowKernel(void){
+#ifdef CA_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return caRowAvx2;
+#endif
+    return caRowScalar;
+}
+static const CaRow caRow = caRowKernel();
+
+// ====== Tile attive ======
+// Tile da una parola (64 colonne) per TILE_R righe. tileChg dice quali sono
+// cambiate nell'ultima generazione: una tile si ricalcola solo se lei o una
+// delle 8 vicine e' cambiata. Altrimenti la sua parte di nx, che contiene la
+// generazione precedente, e' gia' uguale a cur e resta com'e'.
+#define TILE_R 32
+#define TILE_N (TILE_R*64)      // celle per tile
+#define MAX_TX (MAX_SIDE/64)
+static int TX, TY;
+static std::vector<unsigned char> tileA, tileB;   // (TY+2)x(TX+2), cornice a zero
+static unsigned char *tileChg, *tileNext;
+#define TILE(p,ty,tx) (p)[(size_t)(ty)*(TX+2)+(tx)]
+static int histOk=0;            // nx e' davvero la generazione precedente (niente modifiche a mano)
+static std::atomic<int> nChanged, nBack, nActive;   // tile cambiate, diverse da 2 gen fa, ricalcolate
+static int activeTiles=0;
+static const char* caState="";  // "STABILE" / "PERIODO 2" quando l'autoplay si ferma da solo
+
+static void markCell(int r,int c){ TILE(tileChg,1+r/TILE_R,1+(c>>6))=1; histOk=0; caState=""; }
+static void markAll(void){
+    for(int ty=1;ty<=TY;++ty) for(int tx=1;tx<=TX;++tx) TILE(tileChg,ty,tx)=1;
+    histOk=0; caState="";
+}
+
+// ---- Eta' della roccia ----
+// eta' = gen-born+1 (max 250). born e' a 16 bit e sta tile per tile (4 KB
+// l'una), cosi' a 16K x 16K occupa 512 MB invece di un intero per cella.
+static uint32_t gen=0;
+static std::vector<uint16_t> born;
+
+static inline uint16_t& bornAt(int r,int c){
+    return born[((size_t)(r/TILE_R)*TX + (c>>6))*TILE_N + (r%TILE_R)*64 + (c&63)];
+}
+static inline int cellAge(int r,int c){
+    int a=(uint16_t)(gen-bornAt(r,c))+1;
+    return a<250 ? a : 250;
+}
+
+// ogni 16K generazioni la roccia gia' al massimo torna a born=gen-249,
+// prima che gen-born a 16 bit faccia il giro
+static void ageStripe(int t,int nt){
+    for(int r=H*t/nt; r<H*(t+1)/nt; ++r){
+        const uint64_t* row=ROW(cur,r+1);
+        for(int w=1;w<=WW;++w){
+            uint64_t b=row[w];
+            while(b){
+                uint16_t& o=bornAt(r,(w-1)*64+__builtin_ctzll(b));
+                if((uint16_t)(gen-o)>=249) o=(uint16_t)(gen-249);
+                b&=b-1;
+            }
         }
     }
-    return s;
 }
 
-// ---- Step Birth/Death ----
-static void step(void){
-    for(int r=0;r<H;++r){
-        for(int c=0;c<W;++c){
-            int n=nbors(r,c);
-            unsigned char alive=g[r][c], v=alive;
-            if(!alive && n==BIRTH_N) v=1;
-            else if(alive && n==DEATH_N) v=0;
-            nxt[r][c]=v;
+// ====== Conteggio vicini (Moore 8) per il rendering ======
+// Per ogni parola di cur i 4 bit-plane del conteggio, fatti con gli stessi
+// sommatori dello step. Dopo uno step sono da rifare solo le tile cambiate e
+// le loro vicine (cntStale); step() e display() rifanno quelle in vista a
+// piena risoluzione, i click del mouse correggono gli 8 vicini di +-1.
+static std::vector<uint64_t> cnt;               // 4 parole per parola di cur
+static std::vector<unsigned char> cntStale;     // (TY+2)x(TX+2) come le tile
+#define CNT(r,w) (&cnt[((size_t)(r)*WS+(w))*4])
+
+static inline int cellCount(int r,int c){
+    const uint64_t* p=CNT(r+1,1+(c>>6));
+    int b=c&63;
+    return (int)((p[0]>>b&1) | (p[1]>>b&1)<<1 | (p[2]>>b&1)<<2 | (p[3]>>b&1)<<3);
+}
+static void addCount(int r,int c,int d){
+    if(r<0 || r>=H || c<0 || c>=W || TILE(cntStale,1+r/TILE_R,1+(c>>6))) return;
+    uint64_t* p=CNT(r+1,1+(c>>6));
+    int b=c&63, n=cellCount(r,c)+d;
+    for(int i=0;i<4;++i) p[i] = (p[i] & ~(1ull<<b)) | (uint64_t)(n>>i & 1)<<b;
+}
+static void staleAllCounts(void){ std::fill(cntStale.begin(), cntStale.end(), (unsigned char)1); }
+// le tile cambiate nell'ultimo step sporcano i conteggi propri e delle vicine
+static void staleCounts(void){
+    for(int ty=1;ty<=TY;++ty)
+        for(int tx=1;tx<=TX;++tx)
+            if(TILE(tileChg,ty,tx))
+                for(int dy=-1;dy<=1;++dy) for(int dx=-1;dx<=1;++dx) TILE(cntStale,ty+dy,tx+dx)=1;
+}
+
+// ---- Allocazione ----
+static void allocGrid(int w,int h){
+    W=clampi(w,1,MAX_SIDE); H=clampi(h,1,MAX_SIDE);
+    WW=(W+63)/64; WS=WW+2;
+    TAIL=(W%64) ? (~0ull >> (64-W%64)) : ~0ull;
+    bitsA.assign((size_t)(H+2)*WS,0); bitsB.assign((size_t)(H+2)*WS,0);
+    cur=bitsA.data(); nx=bitsB.data();
+    TX=WW; TY=(H+TILE_R-1)/TILE_R;
+    tileA.assign((size_t)(TY+2)*(TX+2),0); tileB.assign((size_t)(TY+2)*(TX+2),0);
+    tileChg=tileA.data(); tileNext=tileB.data();
+    born.assign((size_t)TX*TY*TILE_N,0);
+    cnt.assign((size_t)(H+2)*WS*4,0);
+    cntStale.assign((size_t)(TY+2)*(TX+2),1);
+    markAll();
+}
+
+// ---- Pool di thread ----
+// I worker restano vivi fra una generazione e l'altra: run(fn) chiama
+// fn(t,n) con t=0..n-1, la striscia 0 la fa il thread chiamante.
+class StripePool {
+public:
+    explicit StripePool(int n): n(n<1?1:n) {
+        for(int t=1;t<this->n;++t) workers.emplace_back(&StripePool::loop,this,t);
+    }
+    ~StripePool(){
+        { std::lock_guard<std::mutex> lk(m); quit=true; }
+        wake.notify_all();
+        for(auto& t: workers) t.join();
+    }
+    int size() const { return n; }
+
+    void run(void (*fn)(int,int)){
+        { std::lock_guard<std::mutex> lk(m); job=fn; pending=n-1; ++round; }
+        wake.notify_all();
+        fn(0,n);
+        std::unique_lock<std::mutex> lk(m);
+        done.wait(lk,[this]{ return pending==0; });
+    }
+
+private:
+    void loop(int self){
+        unsigned seen=0;
+        for(;;){
+            void (*fn)(int,int);
+            {
+                std::unique_lock<std::mutex> lk(m);
+                wake.wait(lk,[&]{ return quit || round!=seen; });
+                if(quit) return;
+                seen=round; fn=job;
+            }
+            fn(self,n);
+            std::lock_guard<std::mutex> lk(m);
+            if(--pending==0) done.notify_all();
         }
     }
-    for(int r=0;r<H;++r){
-        for(int c=0;c<W;++c){
-            g[r][c]=nxt[r][c];
-            age[r][c]=g[r][c] ? (unsigned char)(age[r][c] + (age[r][c]<250)) : 0;
+
+    int n;
+    std::vector<std::thread> workers;
+    std::mutex m;
+    std::condition_variable wake, done;
+    void (*job)(int,int)=nullptr;
+    unsigned round=0;
+    int pending=0;
+    bool quit=false;
+};
+
+static StripePool* pool=nullptr;
+
+// (ri)crea il pool con n thread (n<=0: uno per core)
+static void setThreads(int n){
+    if(n<=0) n=(int)std::thread::hardware_concurrency();
+    if(n<=0) n=1;
+    nThreads=n;
+    delete pool;
+    pool=new StripePool(n);
+}
+
+// sotto ~2K parole (128K celle) conviene restare su un thread
+#define MT_MIN_WORDS 2048
+static void runStripes(void (*fn)(int,int)){
+    if(!pool) setThreads(nThreads);
+    if(pool->size()<2 || H*WW<MT_MIN_WORDS) fn(0,1);
+    else pool->run(fn);
+}
+
+// ---- Conteggi delle tile in vista ----
+static int cntTy0, cntTy1, cntTx0, cntTx1;
+
+static void countStripe(int t,int nt){
+    int n=cntTy1-cntTy0+1;
+    for(int ty=cntTy0+n*t/nt; ty<cntTy0+n*(t+1)/nt; ++ty){
+        int r0=1+(ty-1)*TILE_R, r1=ty*TILE_R<H ? ty*TILE_R : H;
+        for(int tx=cntTx0;tx<=cntTx1;++tx){
+            if(!TILE(cntStale,ty,tx)) continue;
+            for(int r=r0;r<=r1;++r){
+                const uint64_t* cr=ROW(cur,r)+tx;
+                caCount(cr-WS, cr, cr+WS, CNT(r,tx));
+            }
+            TILE(cntStale,ty,tx)=0;
+        }
+    }
+}
+// celle r0..r1-1 x c0..c1-1
+static void refreshCounts(int r0,int r1,int c0,int c1){
+    if(r0>=r1 || c0>=c1) return;
+    cntTy0=1+r0/TILE_R; cntTy1=1+(r1-1)/TILE_R;
+    cntTx0=1+(c0>>6);   cntTx1=1+((c1-1)>>6);
+    runStripes(countStripe);
+}
+
+// celle in vista (r0..r1-1 x c0..c1-1); ritorna il lato k dei blocchi di
+// dettaglio, 1 se ogni cella copre almeno un pixel
+static int viewCells(int* r0,int* r1,int* c0,int* c1){
+    *c0=clampi((int)floorf(xminV),0,W); *c1=clampi((int)ceilf(xmaxV),0,W);
+    *r0=clampi((int)floorf(yminV),0,H); *r1=clampi((int)ceilf(ymaxV),0,H);
+    float ppc=winW/(xmaxV-xminV);       // pixel per cella
+    int k=1;
+    while(k*ppc<1.0f && k<MAX_SIDE) k*=2;
+    return k;
+}
+
+// ---- Step Birth/Death ----
+static uint64_t stepKb[8];   // bit di BIRTH_N e DEATH_N come maschere
+
+// Le strisce sono fatte di righe di tile: ognuna scrive solo le sue righe di
+// nx, born e tileNext. L'alone (la riga sopra e sotto) lo legge da cur, e
+// tileChg serve solo in lettura, quindi durante lo step nessuno si pesta.
+static void stepStripe(int t,int nt){
+    uint64_t row[MAX_WS];
+    unsigned char need[MAX_TX+2];
+    int changed=0, back=0, active=0;
+    for(int ty=1+TY*t/nt; ty<=TY*(t+1)/nt; ++ty){
+        for(int tx=1;tx<=TX;++tx){
+            const unsigned char *a=&TILE(tileChg,ty-1,tx), *b=&TILE(tileChg,ty,tx), *c=&TILE(tileChg,ty+1,tx);
+            need[tx] = a[-1]|a[0]|a[1] | b[-1]|b[0]|b[1] | c[-1]|c[0]|c[1];
+            TILE(tileNext,ty,tx)=0;
+            active+=need[tx];
+        }
+        int r0=1+(ty-1)*TILE_R, r1=clampi(ty*TILE_R,1,H);
+        for(int tx=1;tx<=TX;){
+            if(!need[tx]){ ++tx; continue; }
+            int w0=tx;                      // tile attive contigue: una sola passata
+            while(tx<=TX && need[tx]) ++tx;
+            int w1=tx-1;
+            for(int r=r0;r<=r1;++r){
+                const uint64_t* cr=ROW(cur,r);
+                uint64_t* nr=ROW(nx,r);
+                caRow(row, cr-WS, cr, cr+WS, stepKb, w0, w1);
+                if(w1==WW) row[WW] &= TAIL;     // niente celle oltre W
+                for(int w=w0;w<=w1;++w){
+                    uint64_t v=row[w], d=v^cr[w];
+                    TILE(tileNext,ty,w) |= d!=0;
+                    back |= v!=nr[w];
+                    // le nascite (bit 0->1) fissano born per l'eta'
+                    uint64_t b=v & ~cr[w];
+                    while(b){ bornAt(r-1,(w-1)*64+__builtin_ctzll(b))=(uint16_t)gen; b&=b-1; }
+                    nr[w]=v;
+                }
+            }
         }
+        for(int tx=1;tx<=TX;++tx) changed+=TILE(tileNext,ty,tx);
     }
+    nChanged+=changed; nBack+=back; nActive+=active;
+}
+
+static void step(void){
+    for(int i=0;i<4;++i){
+        stepKb[i]   = (BIRTH_N>>i & 1) ? ~0ull : 0;
+        stepKb[4+i] = (DEATH_N>>i & 1) ? ~0ull : 0;
+    }
+    ++gen;
+    nChanged=0; nBack=0; nActive=0;
+    runStripes(stepStripe);
+    uint64_t* t=cur; cur=nx; nx=t;      // scambio, niente copia
+    unsigned char* f=tileChg; tileChg=tileNext; tileNext=f;
+    if(!(gen & 0x3FFF)) runStripes(ageStripe);
+    activeTiles=nActive;
+    // fermo: niente e' cambiato, oppure si torna alla generazione di due passi fa
+    if(!nChanged){ caState="STABILE"; autoplay=0; }
+    else if(histOk && !nBack){ caState="PERIODO 2"; autoplay=0; }
+    else caState="";
+    histOk=1;
+    // conteggi per il rendering: solo dove e' cambiato qualcosa e si vede
+    staleCounts();
+    int r0,r1,c0,c1;
+    if(viewCells(&r0,&r1,&c0,&c1)==1) refreshCounts(r0,r1,c0,c1);
     glutPostRedisplay();
 }
 
 // ---- Seed/Clear ----
+static RngStream rng;   // seme dall'orologio in main()
+
 static void randomSeed(int pct){
     pct = clampi(pct, 0, 100);
-    for(int r=0;r<H;++r) for(int c=0;c<W;++c){
-        g[r][c] = (rand()%100) < pct;
-        age[r][c] = g[r][c] ? 1 : 0;
+    static std::vector<float> u;
+    u.resize(W);
+    for(int r=0;r<H;++r){
+        rng_fill_uniform(&rng, u.data(), W);
+        uint64_t* row=ROW(cur,r+1);
+        for(int w=1;w<=WW;++w) row[w]=0;
+        for(int c=0;c<W;++c){
+            if(u[c]*100.0f < pct){ row[1+(c>>6)] |= 1ull<<(c&63); bornAt(r,c)=(uint16_t)gen; }
+        }
     }
+    markAll();
+    staleAllCounts();
     glutPostRedisplay();
 }
 static void clearAll(void){
-    for(int r=0;r<H;++r) for(int c=0;c<W;++c){ g[r][c]=0; age[r][c]=0; }
+    for(int r=1;r<=H;++r) for(int w=1;w<=WW;++w) ROW(cur,r)[w]=0;
+    markAll();
+    staleAllCounts();
     glutPostRedisplay();
 }
 
 // ---- Proiezione ----
+// su griglie grandi lo zoom deve arrivare a una decina di righe in vista
+static float zoomMax(void){ return fmaxf(20.0f, H*0.12f); }
+
 static void applyProjection(void){
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
@@ -90,26 +456,48 @@ static void applyProjection(void){
 
 // ---- Colori ----
 static void setRockColor(int r,int c){
-    float t = age[r][c]/255.0f;
+    float t = cellAge(r,c)/255.0f;
     float dark=0.35f*t;
     float R=0.50f-dark, G=0.46f-dark, B=0.40f-dark;
     glColor3f(clampf(R,0.08f,0.9f), clampf(G,0.08f,0.9f), clampf(B,0.08f,0.9f));
 }
 static void setAirColor(int r,int c){
-    int n = nbors(r,c);
+    int n = cellCount(r,c);
     float occl=0.06f*n;
     glColor3f(0.07f+0.26f*occl, 0.08f+0.19f*occl, 0.10f+0.14f*occl);
 }
 
+// ---- Livello di dettaglio ----
+// Quando una cella e' piu' piccola di un pixel si disegnano blocchi k x k
+// (k potenza di 2) col colore mescolato secondo la frazione di roccia.
+static int rockCount(int r,int c,int k){
+    int r1=r+k<H ? r+k : H, n=0;
+    if(k<64){                           // il blocco sta dentro una parola
+        uint64_t m=((1ull<<k)-1) << (c&63);
+        for(;r<r1;++r) n+=__builtin_popcountll(ROW(cur,r+1)[1+(c>>6)] & m);
+    } else {
+        int w0=1+(c>>6), w1=(c+k)>>6 < WW ? (c+k)>>6 : WW;
+        for(;r<r1;++r){
+            const uint64_t* row=ROW(cur,r+1);
+            for(int w=w0;w<=w1;++w) n+=__builtin_popcountll(row[w]);
+        }
+    }
+    return n;
+}
+static void setBlockColor(float f){
+    // fra aria senza occlusione e roccia di media eta'
+    glColor3f(0.07f+0.255f*f, 0.08f+0.205f*f, 0.10f+0.125f*f);
+}
+
 // ---- Grid overlay ----
-static void drawGridLines(void){
+static void drawGridLines(int r0,int r1,int c0,int c1){
     if(!showGrid) return;
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glColor4f(1,1,1,0.09f);
     glBegin(GL_LINES);
-    for(int c=0;c<=W;++c){ glVertex2f(c,0); glVertex2f(c,H); }
-    for(int r=0;r<=H;++r){ glVertex2f(0,r); glVertex2f(W,r); }
+    for(int c=c0;c<=c1;++c){ glVertex2f(c,r0); glVertex2f(c,r1); }
+    for(int r=r0;r<=r1;++r){ glVertex2f(c0,r); glVertex2f(c1,r); }
     glEnd();
     glDisable(GL_BLEND);
 }
@@ -126,9 +514,9 @@ static void drawHUD(void){
 
     glColor3f(1,1,1);
     glRasterPos2i(10, winH - 20);   // margine 10px, 20px dal top
-    char buf[128];
-    snprintf(buf,sizeof(buf),"Seed:%d%%  Birth:%d  Death:%d  Mode:%s",
-             seedPct, BIRTH_N, DEATH_N, autoplay?"AUTO":"MANUAL");
+    char buf[240];
+    snprintf(buf,sizeof(buf),"%dx%d  Seed:%d%%  Birth:%d  Death:%d  Mode:%s  Threads:%d  Tile:%d/%d %s",
+             W, H, seedPct, BIRTH_N, DEATH_N, autoplay?"AUTO":"MANUAL", nThreads, activeTiles, TY*TX, caState);
     for(char* p=buf; *p; ++p) glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *p);
 
     glPopMatrix();
@@ -149,18 +537,33 @@ static void display(void){
     glVertex2f(xmaxV,ymaxV); glVertex2f(xminV,ymaxV);
     glEnd();
 
-    // celle
+    // solo le celle dentro la vista
+    int r0,r1,c0,c1;
+    int k=viewCells(&r0,&r1,&c0,&c1);
+    if(k==1) refreshCounts(r0,r1,c0,c1);    // di solito gia' fatto dallo step
+
     glBegin(GL_QUADS);
-    for(int r=0;r<H;++r){
-        for(int c=0;c<W;++c){
-            if(g[r][c]) setRockColor(r,c); else setAirColor(r,c);
-            float x0=c, y0=r, x1=c+1.0f, y1=r+1.0f;
-            glVertex2f(x0,y0); glVertex2f(x1,y0); glVertex2f(x1,y1); glVertex2f(x0,y1);
+    if(k==1){
+        for(int r=r0;r<r1;++r){
+            for(int c=c0;c<c1;++c){
+                if(cellBit(r,c)) setRockColor(r,c); else setAirColor(r,c);
+                float x0=c, y0=r, x1=c+1.0f, y1=r+1.0f;
+                glVertex2f(x0,y0); glVertex2f(x1,y0); glVertex2f(x1,y1); glVertex2f(x0,y1);
+            }
+        }
+    } else {
+        for(int r=r0/k*k; r<r1; r+=k){
+            for(int c=c0/k*k; c<c1; c+=k){
+                int nr=r+k<H ? k : H-r, nc=c+k<W ? k : W-c;
+                setBlockColor(rockCount(r,c,k)/(float)(nr*nc));
+                float x0=c, y0=r, x1=c+nc, y1=r+nr;
+                glVertex2f(x0,y0); glVertex2f(x1,y0); glVertex2f(x1,y1); glVertex2f(x0,y1);
+            }
         }
     }
     glEnd();
 
-    drawGridLines();
+    if(k==1 && winW>=4.0f*(xmaxV-xminV)) drawGridLines(r0,r1,c0,c1);
     drawHUD();
 
     glutSwapBuffers();
@@ -175,7 +578,7 @@ static void keyboard(unsigned char k,int,int){
         case 'r': randomSeed(seedPct); break;
         case 'c': clearAll(); break;
         case 'g': showGrid=!showGrid; glutPostRedisplay(); break;
-        case '+': zoom=fminf(20.0f, zoom*1.1f); applyProjection(); glutPostRedisplay(); break;
+        case '+': zoom=fminf(zoomMax(), zoom*1.1f); applyProjection(); glutPostRedisplay(); break;
         case '-': zoom=fmaxf(0.1f, zoom/1.1f); applyProjection(); glutPostRedisplay(); break;
         case 'w': camY += 5.0f/zoom; applyProjection(); glutPostRedisplay(); break;
         case 's': camY -= 5.0f/zoom; applyProjection(); glutPostRedisplay(); break;
@@ -183,10 +586,12 @@ static void keyboard(unsigned char k,int,int){
         case 'd': camX += 5.0f/zoom; applyProjection(); glutPostRedisplay(); break;
         case '[': seedPct = clampi(seedPct-1,10,60); glutPostRedisplay(); break;
         case ']': seedPct = clampi(seedPct+1,10,60); glutPostRedisplay(); break;
-        case 'b': BIRTH_N = clampi(BIRTH_N-1,0,8); glutPostRedisplay(); break;
-        case 'n': BIRTH_N = clampi(BIRTH_N+1,0,8); glutPostRedisplay(); break;
-        case 'k': DEATH_N = clampi(DEATH_N-1,0,8); glutPostRedisplay(); break;
-        case 'l': DEATH_N = clampi(DEATH_N+1,0,8); glutPostRedisplay(); break;
+        case 'b': BIRTH_N = clampi(BIRTH_N-1,0,8); markAll(); glutPostRedisplay(); break;
+        case 'n': BIRTH_N = clampi(BIRTH_N+1,0,8); markAll(); glutPostRedisplay(); break;
+        case 'k': DEATH_N = clampi(DEATH_N-1,0,8); markAll(); glutPostRedisplay(); break;
+        case 'l': DEATH_N = clampi(DEATH_N+1,0,8); markAll(); glutPostRedisplay(); break;
+        case 't': if(nThreads>1){ setThreads(nThreads-1); glutPostRedisplay(); } break;
+        case 'T': setThreads(nThreads+1); glutPostRedisplay(); break;
     }
 }
 static void special(int key,int,int){
@@ -201,11 +606,15 @@ static void mouse(int btn,int state,int x,int y){
         float fy = yminV + ((winH-1-y)/(float)winH)*(ymaxV-yminV);
         int c=(int)floorf(fx), r=(int)floorf(fy);
         if(r>=0 && r<H && c>=0 && c<W){
-            g[r][c]=!g[r][c]; age[r][c]=g[r][c]?1:0;
+            ROW(cur,r+1)[1+(c>>6)] ^= 1ull<<(c&63);
+            bornAt(r,c)=(uint16_t)gen;
+            markCell(r,c);
+            int d=cellBit(r,c) ? 1 : -1;        // i vicini ne contano uno in piu' o in meno
+            for(int dr=-1;dr<=1;++dr) for(int dc=-1;dc<=1;++dc) if(dr||dc) addCount(r+dr,c+dc,d);
             glutPostRedisplay();
         }
     }
-    if(btn==3 && state==GLUT_DOWN){ zoom=fminf(20.0f, zoom*1.1f); applyProjection(); glutPostRedisplay(); }
+    if(btn==3 && state==GLUT_DOWN){ zoom=fminf(zoomMax(), zoom*1.1f); applyProjection(); glutPostRedisplay(); }
     if(btn==4 && state==GLUT_DOWN){ zoom=fmaxf(0.1f, zoom/1.1f); applyProjection(); glutPostRedisplay(); }
     if(btn==GLUT_RIGHT_BUTTON && state==GLUT_DOWN){ draggingPan=1; lastX=x; lastY=y; }
     if(btn==GLUT_RIGHT_BUTTON && state==GLUT_UP)  { draggingPan=0; }
@@ -239,8 +648,17 @@ static void initGL(void){
 }
 
 int main(int argc,char**argv){
-    srand((unsigned)time(NULL));
+    rng_seed(&rng, (uint64_t)time(NULL), 0);
     glutInit(&argc,argv);
+    int gw=W, gh=H;
+    for(int a=1; a+1<argc; ++a){
+        if(!strcmp(argv[a],"-t")) nThreads=atoi(argv[a+1]);   // thread
+        if(!strcmp(argv[a],"-w")) gw=atoi(argv[a+1]);         // larghezza griglia
+        if(!strcmp(argv[a],"-h")) gh=atoi(argv[a+1]);         // altezza griglia
+    }
+    allocGrid(gw,gh);
+    camX=W*0.5f; camY=H*0.5f;
+    setThreads(nThreads);
     glutInitDisplayMode(GLUT_DOUBLE|GLUT_RGB);
     glutInitWindowSize(winW,winH);
     glutCreateWindow("Caverne CA - Parametric B/D + Seed (Pan/Zoom)");
@@ -0,0 +1,303 @@
+// ----------------- RNG condiviso -----------------
+// Generatore counter-based Philox4x32-10 (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"): l'uscita e' una funzione pura di
+// (contatore a 128 bit, chiave a 64 bit), quindi
+// - stesso risultato su ogni piattaforma e compilatore;
+// - nessuno stato globale: ogni thread/cella puo' avere il suo flusso;
+// - salto in avanti O(1): basta sommare al contatore.
+// Uso:
+// - flussi sequenziali: RngStream con rng_seed(seme, flusso), rng_u32(),
+//   rng_uniform(), rng_below(), rng_normal(), rng_jump();
+// - per cella: rng_at(seme, chiave, x, y) o rng_normal_at(...), senza stato;
+//   rng_hash_at() e' un hash leggero per chi usa una sola parola per cella;
+// - in blocco: rng_fill_u32/uniform/normal (AVX2 se la CPU lo supporta).
+// Le normali usano lo ziggurat di Marsaglia-Tsang a 128 strati: quasi
+// sempre un confronto e una moltiplicazione, log/exp solo negli strati rari.
+#ifndef TERRAIN_RNG_H
+#define TERRAIN_RNG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RNG_SIMD 1               // Philox AVX2 con scelta a runtime
+#include <immintrin.h>
+#endif
+
+#define RNG_M0 0xD2511F53u
+#define RNG_M1 0xCD9E8D57u
+#define RNG_W0 0x9E3779B9u
+#define RNG_W1 0xBB67AE85u
+
+// un blocco: 4 parole casuali dal contatore c e dalla chiave k
+static inline void rng_philox(const uint32_t c[4], const uint32_t k[2], uint32_t out[4]){
+    uint32_t c0=c[0], c1=c[1], c2=c[2], c3=c[3], k0=k[0], k1=k[1];
+    for(int r=0; r<10; r++){
+        uint64_t p0 = (uint64_t)RNG_M0*c0, p1 = (uint64_t)RNG_M1*c2;
+        uint32_t n0 = (uint32_t)(p1>>32)^c1^k0, n2 = (uint32_t)(p0>>32)^c3^k1;
+        c0 = n0; c1 = (uint32_t)p1; c2 = n2; c3 = (uint32_t)p0;
+        k0 += RNG_W0; k1 += RNG_W1;
+    }
+    out[0]=c0; out[1]=c1; out[2]=c2; out[3]=c3;
+}
+
+// parole [0,1) e (0,1) a 24 bit: stesso risultato in float su ogni CPU
+static inline float rng_to_uniform(uint32_t u){ return (float)(u>>8)*(1.0f/16777216.0f); }
+static inline float rng_to_open(uint32_t u){ return ((float)(u>>8)+0.5f)*(1.0f/16777216.0f); }
+
+// ----------------- Flussi sequenziali -----------------
+// contatore = (blocco a 64 bit, flusso a 64 bit), chiave = seme
+typedef struct {
+    uint32_t key[2];
+    uint32_t ctr[4];             // blocco successivo da generare
+    uint32_t buf[4];             // blocco corrente
+    int pos;                     // parole gia' usate di buf (4: vuoto)
+} RngStream;
+
+static inline void rng_seed(RngStream* s, uint64_t seed, uint64_t stream){
+    s->key[0]=(uint32_t)seed; s->key[1]=(uint32_t)(seed>>32);
+    s->ctr[0]=s->ctr[1]=0;
+    s->ctr[2]=(uint32_t)stream; s->ctr[3]=(uint32_t)(stream>>32);
+    s->pos=4;
+}
+
+static inline void rng_ctr_add(uint32_t c[2], uint64_t n){
+    uint64_t b = ((uint64_t)c[1]<<32 | c[0]) + n;
+    c[0]=(uint32_t)b; c[1]=(uint32_t)(b>>32);
+}
+
+static inline uint32_t rng_u32(RngStream* s){
+    if(s->pos==4){
+        rng_philox(s->ctr, s->key, s->buf);
+        rng_ctr_add(s->ctr, 1);
+        s->pos=0;
+    }
+    return s->buf[s->pos++];
+}
+
+// salta n parole in O(1)
+static inline void rng_jump(RngStream* s, uint64_t n){
+    uint64_t p = (uint64_t)s->pos + n;
+    if(p<=4){ s->pos=(int)p; return; }
+    // il blocco che contiene la parola p e' (ctr-1) + p/4
+    rng_ctr_add(s->ctr, (p-1)/4 - 1);
+    rng_philox(s->ctr, s->key, s->buf);
+    rng_ctr_add(s->ctr, 1);
+    s->pos = (int)((p-1)%4) + 1;
+}
+
+static inline float rng_uniform(RngStream* s){ return rng_to_uniform(rng_u32(s)); }
+
+// intero uniforme in [0,n) senza distorsione (Lemire)
+static inline uint32_t rng_below(RngStream* s, uint32_t n){
+    uint64_t m = (uint64_t)rng_u32(s)*n;
+    if((uint32_t)m < n){
+        uint32_t t = (0u-n)%n;
+        while((uint32_t)m < t) m = (uint64_t)rng_u32(s)*n;
+    }
+    return (uint32_t)(m>>32);
+}
+
+// ----------------- Ziggurat -----------------
+// tabelle di Marsaglia-Tsang (RNOR, 128 strati), costruite all'avvio
+struct RngZiggurat {
+    uint32_t kn[128];
+    float wn[128], fn[128];
+    RngZiggurat(){
+        const double m1 = 2147483648.0, vn = 9.91256303526217e-3;
+        double dn = 3.442619855899, tn = dn, q = vn/exp(-.5*dn*dn);
+        kn[0] = (uint32_t)((dn/q)*m1); kn[1] = 0;
+        wn[0] = (float)(q/m1);  wn[127] = (float)(dn/m1);
+        fn[0] = 1.0f;           fn[127] = (float)exp(-.5*dn*dn);
+        for(int i=126; i>=1; i--){
+            dn = sqrt(-2.0*log(vn/dn + exp(-.5*dn*dn)));
+            kn[i+1] = (uint32_t)((dn/tn)*m1);
+            tn = dn;
+            fn[i] = (float)exp(-.5*dn*dn);
+            wn[i] = (float)(dn/m1);
+        }
+    }
+};
+static const RngZiggurat rng_zig;
+
+// normale standard; next() fornisce parole a 32 bit
+template<class Next>
+static inline float rng_ziggurat(Next& next){
+    const float r = 3.442620f;
+    for(;;){
+        uint32_t u = next();
+        uint32_t iz = u & 127;                       // strato dai 7 bit bassi,
+        int32_t hz = (int32_t)(u & ~127u);           // valore dagli altri (scorrelati)
+        uint32_t az = hz<0 ? 0u-(uint32_t)hz : (uint32_t)hz;
+        float x = hz*rng_zig.wn[iz];
+        if(az < rng_zig.kn[iz]) return x;            // ~99%
+        if(iz==0){                                   // coda oltre r
+            float y;
+            do{
+                x = -logf(rng_to_open(next()))*(1.0f/r);
+                y = -logf(rng_to_open(next()));
+            }while(y+y < x*x);
+            return hz>0 ? r+x : -r-x;
+        }
+        if(rng_zig.fn[iz] + rng_to_open(next())*(rng_zig.fn[iz-1]-rng_zig.fn[iz]) < expf(-.5f*x*x))
+            return x;
+    }
+}
+
+struct RngStreamNext {
+    RngStream* s;
+    uint32_t operator()(){ return rng_u32(s); }
+};
+
+static inline float rng_normal(RngStream* s){
+    RngStreamNext n = { s };
+    return rng_ziggurat(n);
+}
+
+// ----------------- Per cella (senza stato) -----------------
+// 4 parole per (seme, chiave, x, y): contatore = (0, x, y, chiave)
+static inline void rng_at(uint64_t seed, uint32_t key, int32_t x, int32_t y, uint32_t out[4]){
+    uint32_t c[4] = { 0, (uint32_t)x, (uint32_t)y, key };
+    uint32_t k[2] = { (uint32_t)seed, (uint32_t)(seed>>32) };
+    rng_philox(c, k, out);
+}
+
+static inline uint32_t rng_u32_at(uint64_t seed, uint32_t key, int32_t x, int32_t y){
+    uint32_t o[4];
+    rng_at(seed, key, x, y, o);
+    return o[0];
+}
+
+// hash a 32 bit di (seme, chiave, x, y): ~5x piu' veloce di un blocco Philox,
+// meno robusto ma sufficiente per gli spostamenti per cella (si usano 24 bit)
+static inline uint32_t rng_hash_at(uint64_t seed, uint32_t key, int32_t x, int32_t y){
+    uint32_t h = ((uint32_t)seed ^ (uint32_t)(seed>>32)) ^ (key*0x9E3779B9u);
+    h ^= (uint32_t)x*0x85EBCA6Bu; h = (h^(h>>15))*0x2C1B3C6Du;
+    h ^= (uint32_t)y*0xC2B2AE35u; h = (h^(h>>13))*0x297A2D39u;
+    h ^= h>>16;
+    return h;
+}
+
+// normale della cella: le 4 parole del primo blocco bastano quasi sempre,
+// poi si prosegue sul contatore della cella
+struct RngCellNext {
+    uint32_t c[4], k[2], buf[4];
+    int pos;
+    uint32_t operator()(){
+        if(pos==4){ c[0]++; rng_philox(c, k, buf); pos=0; }
+        return buf[pos++];
+    }
+};
+
+static inline float rng_normal_at(uint64_t seed, uint32_t key, int32_t x, int32_t y){
+    RngCellNext n = { { 0, (uint32_t)x, (uint32_t)y, key }, { (uint32_t)seed, (uint32_t)(seed>>32) }, {0,0,0,0}, 0 };
+    rng_philox(n.c, n.k, n.buf);
+    return rng_ziggurat(n);
+}
+
+// ----------------- In blocco -----------------
+// stessa sequenza di rng_u32() ripetuta, ma 8 blocchi Philox alla volta
+
+static inline void rng_blocks_scalar(RngStream* s, uint32_t* out, size_t nblk){
+    for(size_t b=0; b<nblk; b++){
+        rng_philox(s->ctr, s->key, out+4*b);
+        rng_ctr_add(s->ctr, 1);
+    }
+}
+
+#ifdef RNG_SIMD
+// prodotto 32x32->64 sulle 8 corsie: parte bassa e alta
+__attribute__((target("avx2")))
+static inline void rng_mulhilo8(__m256i a, uint32_t m, __m256i* lo, __m256i* hi){
+    __m256i mm = _mm256_set1_epi32((int)m);
+    __m256i ev = _mm256_mul_epu32(a, mm);                          // corsie pari
+    __m256i od = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), mm);   // corsie dispari
+    *lo = _mm256_blend_epi32(ev, _mm256_slli_epi64(od, 32), 0xAA);
+    *hi = _mm256_blend_epi32(_mm256_srli_epi64(ev, 32), od, 0xAA);
+}
+
+__attribute__((target("avx2")))
+static void rng_blocks_avx2(RngStream* s, uint32_t* out, size_t nblk){
+    size_t b = 0;
+    alignas(32) uint32_t w[4][8];
+    for(; b+8<=nblk && s->ctr[0] <= 0xFFFFFFFFu-8; b+=8){       // niente riporto nel gruppo
+        __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32((int)s->ctr[0]), _mm256_setr_epi32(0,1,2,3,4,5,6,7));
+        __m256i c1 = _mm256_set1_epi32((int)s->ctr[1]);
+        __m256i c2 = _mm256_set1_epi32((int)s->ctr[2]);
+        __m256i c3 = _mm256_set1_epi32((int)s->ctr[3]);
+        uint32_t k0 = s->key[0], k1 = s->key[1];
+        for(int r=0; r<10; r++){
+            __m256i lo0, hi0, lo1, hi1;
+            rng_mulhilo8(c0, RNG_M0, &lo0, &hi0);
+            rng_mulhilo8(c2, RNG_M1, &lo1, &hi1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32((int)k0));
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32((int)k1));
+            c1 = lo1; c3 = lo0;
+            k0 += RNG_W0; k1 += RNG_W1;
+        }
+        _mm256_store_si256((__m256i*)w[0], c0);
+        _mm256_store_si256((__m256i*)w[1], c1);
+        _mm256_store_si256((__m256i*)w[2], c2);
+        _mm256_store_si256((__m256i*)w[3], c3);
+        for(int i=0; i<8; i++){
+            uint32_t* o = out+4*(b+i);
+            o[0]=w[0][i]; o[1]=w[1][i]; o[2]=w[2][i]; o[3]=w[3][i];
+        }
+        rng_ctr_add(s->ctr, 8);
+    }
+    rng_blocks_scalar(s, out+4*b, nblk-b);
+}
+#endif
+
+typedef void (*RngBlocks)(RngStream*, uint32_t*, size_t);
+
+static inline RngBlocks rng_blocks_kernel(){
+#ifdef RNG_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return rng_blocks_avx2;
+#endif
+    return rng_blocks_scalar;
+}
+static const RngBlocks rng_blocks = rng_blocks_kernel();
+
+// n parole a 32 bit
+static inline void rng_fill_u32(RngStream* s, uint32_t* out, size_t n){
+    size_t i = 0;
+    while(i<n && s->pos<4) out[i++] = s->buf[s->pos++];   // resto del blocco corrente
+    size_t nblk = (n-i)/4;
+    rng_blocks(s, out+i, nblk);
+    i += 4*nblk;
+    while(i<n) out[i++] = rng_u32(s);
+}
+
+// n float uniformi in [0,1)
+static inline void rng_fill_uniform(RngStream* s, float* out, size_t n){
+    uint32_t u[256];
+    for(size_t i=0; i<n; i+=256){
+        size_t m = n-i < 256 ? n-i : 256;
+        rng_fill_u32(s, u, m);
+        for(size_t j=0; j<m; j++) out[i+j] = rng_to_uniform(u[j]);
+    }
+}
+
+// n normali standard: parole generate in blocco, poi ziggurat
+struct RngBufferNext {
+    RngStream* s;
+    uint32_t buf[256];
+    size_t pos, len;
+    uint32_t operator()(){
+        if(pos==len){ rng_fill_u32(s, buf, 256); pos=0; len=256; }
+        return buf[pos++];
+    }
+};
+
+static inline void rng_fill_normal(RngStream* s, float* out, size_t n){
+    RngBufferNext nx;
+    nx.s = s; nx.pos = nx.len = 0;
+    for(size_t i=0; i<n; i++) out[i] = rng_ziggurat(nx);
+    // le parole non usate del buffer vanno perse: la sequenza resta
+    // deterministica ma non coincide con n chiamate a rng_normal()
+}
+
+#endif // TERRAIN_RNG_H
@@ -1,152 +1,498 @@
 
 
 
+#ifndef _WIN32
+#define _FILE_OFFSET_BITS 64    // file oltre 2 GB anche a 32 bit (modo -ooc)
+#endif
 #include <GL/glut.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
-
-#define K 8                 // griglia = 2^K + 1   (es. K=8 -> 257x257)
-#define N ((1<<K)+1)
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+#include "../Common/rng.h"
+#ifdef _WIN32
+#include <windows.h>            // file mapping per il modo -ooc
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define K_DEF 8             // griglia = 2^K + 1   (es. K=8 -> 257x257), -k K a runtime
 #define ZSCALE 18.0f
+#define TB 4                // tile di 2^TB x 2^TB celle (16x16 float = 1 KB)
+#define TM ((1<<TB)-1)
+
+// heightmap (2^K+1)^2 con layout scelto a runtime:
+// - row-major: cella (x,y) in y*n+x, come il vecchio H[N][N]
+// - a tile: tile 16x16 contigui, per righe di tile; i vicini y+-half dei
+//   livelli profondi stanno nella stessa tile invece che a half righe di distanza.
+//   Diamond e square pero' scorrono per righe, che il prefetch hardware segue
+//   bene in row-major: con -bench il layout a tile risulta piu' lento, quindi
+//   il default resta row-major (-tiles per l'altro)
+struct HeightMap {
+    int k, n;                       // n = 2^k+1
+    int tiled;                      // 0: row-major, 1: a tile
+    int tiles_x;                    // tile per riga
+    std::vector<float> h;           // quote
+
+    void init(int kk, int t, int nn=0){     // nn: lato diverso da 2^k+1 (mosaico)
+        k=kk; n=nn ? nn : (1<<k)+1; tiled=t;
+        tiles_x=(n+TM)>>TB;
+        size_t cells = tiled ? (size_t)tiles_x*tiles_x<<(2*TB) : (size_t)n*n;
+        h.assign(cells, 0.0f);
+    }
+    inline size_t idx(int x, int y) const {
+        return tiled ? ((((size_t)(y>>TB)*tiles_x+(x>>TB))<<(2*TB)) | ((y&TM)<<TB) | (x&TM))
+                     : (size_t)y*n+x;
+    }
+    inline float& at(int x, int y){ return h[idx(x,y)]; }
+};
+
+// layout fissato a compile time per i cicli di diamond/square:
+// idx(x,y) = row(y) + col(x), con row() calcolato una volta per riga
+struct RowLayout {
+    static inline size_t row(const HeightMap& m, int y){ return (size_t)y*m.n; }
+    static inline size_t col(int x){ return x; }
+};
+struct TileLayout {
+    static inline size_t row(const HeightMap& m, int y){
+        return ((size_t)(y>>TB)*m.tiles_x<<(2*TB)) + ((y&TM)<<TB);
+    }
+    static inline size_t col(int x){ return ((size_t)(x>>TB)<<(2*TB)) + (x&TM); }
+};
 
-static float H[N][N];       // heightmap
-static unsigned char UPDATED[N][N];
-static int size = N-1;
+static HeightMap hm;        // heightmap
+static int size;            // n-1
+static int use_tiles = 0;   // layout di hm (-tiles per quello a tile, vedi -bench)
 static int step_len;
 static float jitter;
 static float roughness = 0.55f;
 static int phase = 0;
 static int iter_level = 0;
 static int autoplay = 0;
+static unsigned seed = 0;   // seme della mappa: H dipende solo da seed e roughness
+static int nthreads = 0;    // thread per diamond/square (0 = tutti i core, -t N)
+
+// celle scritte dall'ultimo passo: sono un reticolo, bastano passo e fase
+// (pass_step=0: nessuna, subito dopo il reset)
+static int pass_step = 0, pass_phase = 0;
+static float h_min, h_max;  // min/max correnti di hm, aggiornati da ogni passo
+static int mesh_dirty = 1;  // 1: hm cambiata, la mesh in cache va rifatta
+static int err_dirty = 1;   // 1: hm cambiata, gli errori RTIN vanno ricalcolati
+static int rtin_on = 0;     // 1: mesh adattiva RTIN invece della griglia (tasto M)
+static float rtin_max = 0.01f; // errore massimo della mesh RTIN (unita' di hm)
+static int mosaic_r = 0;    // >0: hm e' un mosaico di (2r+1)^2 tile senza cuciture (-mosaic r)
 
 static float rotY = -35.0f; // rotazione orizzontale
 static float rotX = -35.0f; // rotazione verticale (nuovo)
 static float camX=0, camY=120, camZ=320;
 
 // RNG
-static inline float frand(float a, float b){ return a + (b-a) * (rand()/(float)RAND_MAX); }
+// spostamento casuale in [-1,1] della cella (x,y) al passo 'tag':
+// hash di (seed, tag, x, y), quindi non dipende dall'ordine di visita
+static inline float cell_rand(unsigned tag, int x, int y){
+    return (rng_hash_at(seed, tag, x, y)>>8)*(2.0f/16777215.0f) - 1.0f;
+}
+
+static RngStream ui_rng;    // semi nuovi (tasto R), dall'orologio
+
+// tag di cell_rand: 0 per gli angoli, poi 2*livello+1 (diamond) e 2*livello+2 (square)
+#define TAG_DIAMOND(l) (2u*(l)+1u)
+#define TAG_SQUARE(l)  (2u*(l)+2u)
+
+// esegue fn(r0,r1) su fasce di righe [0,rows) in parallelo;
+// sotto ~16K celle conviene restare su un thread
+template<class F>
+static void parallel_rows(int rows, int cols, F fn){
+    int nt = nthreads>0 ? nthreads : (int)std::thread::hardware_concurrency();
+    if(nt < 1) nt = 1;
+    if(nt > rows) nt = rows;
+    if(nt <= 1 || (long)rows*cols < 16384){ fn(0, rows); return; }
+    std::vector<std::thread> th;
+    for(int t=1; t<nt; t++) th.emplace_back(fn, rows*t/nt, rows*(t+1)/nt);
+    fn(0, rows/nt);
+    for(auto& t: th) t.join();
+}
 
-static void clear_updated(){
-    for(int y=0;y<=size;y++) for(int x=0;x<=size;x++) UPDATED[y][x]=0;
+// unisce il min/max di una fascia a quello globale
+static void merge_minmax(float mn, float mx){
+    static std::mutex m;
+    std::lock_guard<std::mutex> lk(m);
+    if(mn < h_min) h_min = mn;
+    if(mx > h_max) h_max = mx;
 }
 
 static void reset_heightmap(){
-    for(int y=0;y<=size;y++) for(int x=0;x<=size;x++) H[y][x]=0.0f;
-    H[0][0]       = frand(-1.0f, 1.0f);
-    H[0][size]    = frand(-1.0f, 1.0f);
-    H[size][0]    = frand(-1.0f, 1.0f);
-    H[size][size] = frand(-1.0f, 1.0f);
+    std::fill(hm.h.begin(), hm.h.end(), 0.0f);
+    hm.at(0,0)       = cell_rand(0, 0, 0);
+    hm.at(size,0)    = cell_rand(0, size, 0);
+    hm.at(0,size)    = cell_rand(0, 0, size);
+    hm.at(size,size) = cell_rand(0, size, size);
 
     iter_level = 0;
     step_len   = size;
     jitter     = 1.0f;
     phase      = 0;
-    clear_updated();
-}
-
-static void minmax(float* mn, float* mx){
-    *mn=1e9f; *mx=-1e9f;
-    for(int y=0;y<=size;y++) for(int x=0;x<=size;x++){
-        if(H[y][x]<*mn) *mn=H[y][x];
-        if(H[y][x]>*mx) *mx=H[y][x];
-    }
+    pass_step  = 0;
+    // ogni cella e' scritta una volta sola: il min/max si aggiorna per passo.
+    // Lo 0 delle celle non ancora calcolate resta nel range, come nel
+    // vecchio minmax() sull'intera griglia
+    h_min = fminf(0.0f, fminf(fminf(hm.at(0,0), hm.at(size,0)), fminf(hm.at(0,size), hm.at(size,size))));
+    h_max = fmaxf(0.0f, fmaxf(fmaxf(hm.at(0,0), hm.at(size,0)), fmaxf(hm.at(0,size), hm.at(size,size))));
+    mesh_dirty = err_dirty = 1;
 }
 
+// le celle di un passo leggono solo celle di passi precedenti:
+// le righe si dividono fra i thread senza sincronizzazione
+template<class L>
 static void diamond_step(int step, float scale){
-    int half = step/2;
-    for(int y=half; y<size; y+=step){
-        for(int x=half; x<size; x+=step){
-            float a = H[y-half][x-half];
-            float b = H[y-half][x+half];
-            float c = H[y+half][x-half];
-            float d = H[y+half][x+half];
-            float avg = 0.25f*(a+b+c+d);
-            H[y][x] = avg + frand(-scale, scale);
-            UPDATED[y][x] = 1;
+    int half = step/2, rows = size/step;
+    unsigned tag = TAG_DIAMOND(iter_level);
+    float* H = hm.h.data();
+    parallel_rows(rows, rows, [=](int r0, int r1){
+        float mn = 1e9f, mx = -1e9f;
+        for(int y=half+r0*step; y<half+r1*step; y+=step){
+            const float* up = H + L::row(hm,y-half);
+            const float* dn = H + L::row(hm,y+half);
+            size_t r = L::row(hm,y);
+            for(int x=half; x<size; x+=step){
+                size_t cl = L::col(x-half), cr = L::col(x+half);
+                float a = up[cl];
+                float b = up[cr];
+                float c = dn[cl];
+                float d = dn[cr];
+                float avg = 0.25f*(a+b+c+d);
+                float v = avg + scale*cell_rand(tag, x, y);
+                H[r + L::col(x)] = v;
+                mn = fminf(mn, v); mx = fmaxf(mx, v);
+            }
         }
-    }
+        merge_minmax(mn, mx);
+    });
 }
 
+template<class L>
 static void square_step(int step, float scale){
-    int half = step/2;
-    for(int y=0; y<=size; y+=half){
-        int start = ((y/half)%2==0) ? half : 0;
-        for(int x=start; x<=size; x+=step){
-            float sum=0.0f; int cnt=0;
-            if(x-half >= 0)    { sum += H[y][x-half]; cnt++; }
-            if(x+half <= size) { sum += H[y][x+half]; cnt++; }
-            if(y-half >= 0)    { sum += H[y-half][x]; cnt++; }
-            if(y+half <= size) { sum += H[y+half][x]; cnt++; }
-            float avg = (cnt? sum/cnt : 0.0f);
-            H[y][x] = avg + frand(-scale, scale);
-            UPDATED[y][x] = 1;
+    int half = step/2, rows = size/half+1;
+    unsigned tag = TAG_SQUARE(iter_level);
+    float* H = hm.h.data();
+    parallel_rows(rows, size/step+1, [=](int r0, int r1){
+        float mn = 1e9f, mx = -1e9f;
+        for(int y=r0*half; y<r1*half; y+=half){
+            int start = ((y/half)%2==0) ? half : 0;
+            const float* row = H + L::row(hm,y);
+            const float* up = y-half >= 0    ? H + L::row(hm,y-half) : NULL;
+            const float* dn = y+half <= size ? H + L::row(hm,y+half) : NULL;
+            for(int x=start; x<=size; x+=step){
+                size_t cx = L::col(x);
+                float sum=0.0f; int cnt=0;
+                if(x-half >= 0)    { sum += row[L::col(x-half)]; cnt++; }
+                if(x+half <= size) { sum += row[L::col(x+half)]; cnt++; }
+                if(up)             { sum += up[cx]; cnt++; }
+                if(dn)             { sum += dn[cx]; cnt++; }
+                float avg = (cnt? sum/cnt : 0.0f);
+                float v = avg + scale*cell_rand(tag, x, y);
+                H[(row-H) + cx] = v;
+                mn = fminf(mn, v); mx = fmaxf(mx, v);
+            }
         }
-    }
+        merge_minmax(mn, mx);
+    });
 }
 
-static void next_substep(){
+// un passo (diamond o square) della generazione
+static void substep(){
     if(step_len < 2) return;
-    clear_updated();
+    pass_step  = step_len;
+    pass_phase = phase;
+    mesh_dirty = err_dirty = 1;
 
     if(phase == 0){
-        diamond_step(step_len, jitter);
+        if(hm.tiled) diamond_step<TileLayout>(step_len, jitter);
+        else         diamond_step<RowLayout>(step_len, jitter);
         phase = 1;
     } else {
-        square_step(step_len, jitter);
+        if(hm.tiled) square_step<TileLayout>(step_len, jitter);
+        else         square_step<RowLayout>(step_len, jitter);
         phase = 0;
         step_len /= 2;
         jitter   *= roughness;
         iter_level++;
     }
-    glutPostRedisplay();
 }
 
-static void setColor(float h_norm){
-    if(h_norm < 0.30f) glColor3f(0.05f,0.10f,0.65f);
-    else if(h_norm < 0.52f) glColor3f(0.10f,0.55f,0.18f);
-    else if(h_norm < 0.78f) glColor3f(0.45f,0.42f,0.38f);
-    else glColor3f(0.95f,0.97f,0.98f);
+// ----------------- Tile senza cuciture -----------------
+// ds_tile() genera la tile (tx,ty) di lato 2^k+1 di un mondo infinito: la
+// tile copre le celle del mondo [tx*2^k, (tx+1)*2^k] e condivide il bordo
+// con le vicine. Tutto dipende solo da coordinate del mondo:
+// - angoli e spostamenti usano cell_rand sulle coordinate del mondo;
+// - le celle di bordo dello square usano solo i due vicini lungo il bordo
+//   (niente vicino interno), quindi il bordo e' un midpoint 1D fra i due
+//   angoli, identico nelle due tile che lo condividono.
+// Le tile si possono generare in qualunque ordine e su qualunque thread:
+// la funzione legge solo seed e roughness.
+static void ds_tile(int tx, int ty, int k, float* out){
+    int sz = 1<<k, n = sz+1;
+    int ox = tx*sz, oy = ty*sz;             // origine nel mondo
+    #define T_AT(x,y) out[(size_t)(y)*n+(x)]
+    for(int y=0;y<n;y++) for(int x=0;x<n;x++) T_AT(x,y)=0.0f;
+    T_AT(0,0)   = cell_rand(0, ox,    oy);
+    T_AT(sz,0)  = cell_rand(0, ox+sz, oy);
+    T_AT(0,sz)  = cell_rand(0, ox,    oy+sz);
+    T_AT(sz,sz) = cell_rand(0, ox+sz, oy+sz);
+    float scale = 1.0f;
+    for(int step=sz, level=0; step>=2; step/=2, scale*=roughness, level++){
+        int half = step/2;
+        for(int y=half; y<sz; y+=step)
+            for(int x=half; x<sz; x+=step){
+                float avg = 0.25f*(T_AT(x-half,y-half)+T_AT(x+half,y-half)+T_AT(x-half,y+half)+T_AT(x+half,y+half));
+                T_AT(x,y) = avg + scale*cell_rand(TAG_DIAMOND(level), ox+x, oy+y);
+            }
+        for(int y=0; y<=sz; y+=half){
+            int start = ((y/half)%2==0) ? half : 0;
+            for(int x=start; x<=sz; x+=step){
+                float avg;
+                if(y==0 || y==sz)      avg = 0.5f*(T_AT(x-half,y)+T_AT(x+half,y));
+                else if(x==0 || x==sz) avg = 0.5f*(T_AT(x,y-half)+T_AT(x,y+half));
+                else avg = 0.25f*(T_AT(x-half,y)+T_AT(x+half,y)+T_AT(x,y-half)+T_AT(x,y+half));
+                T_AT(x,y) = avg + scale*cell_rand(TAG_SQUARE(level), ox+x, oy+y);
+            }
+        }
+    }
+    #undef T_AT
 }
 
-static void drawTerrain(){
-    float mn,mx; minmax(&mn,&mx);
-    float inv = (mx>mn)? 1.0f/(mx-mn) : 1.0f;
-    float off = size*0.5f;
+// mosaico di (2r+1)^2 tile attorno a (0,0) in hm: le tile sono generate in
+// parallelo, indipendenti, e copiate affiancate (i bordi coincidono).
+// Ogni tile copia solo x<sz, y<sz: la colonna e la riga di bordo sono della
+// tile accanto, tranne sull'ultima colonna/riga del mosaico. Cosi' ogni cella
+// di hm ha un solo thread che la scrive.
+static void build_mosaic(int k, int r){
+    int sz = 1<<k, n = sz+1, side = 2*r+1, count = side*side;
+    hm.init(k, use_tiles, side*sz+1);
+    size = hm.n-1;
+    parallel_rows(count, n*n, [&](int t0, int t1){
+        std::vector<float> t(n*n);
+        for(int i=t0; i<t1; i++){
+            int tx = i%side, ty = i/side;
+            int xe = tx==side-1 ? n : sz, ye = ty==side-1 ? n : sz;
+            ds_tile(tx-r, ty-r, k, t.data());
+            for(int y=0;y<ye;y++) for(int x=0;x<xe;x++) hm.at(tx*sz+x, ty*sz+y) = t[(size_t)y*n+x];
+        }
+    });
+    h_min = 1e9f; h_max = -1e9f;
+    for(int y=0;y<=size;y++) for(int x=0;x<=size;x++){
+        h_min = fminf(h_min, hm.at(x,y)); h_max = fmaxf(h_max, hm.at(x,y));
+    }
+    step_len = 0;                           // niente passi da fare
+    pass_step = 0;
+    mesh_dirty = err_dirty = 1;
+}
 
-    glEnable(GL_DEPTH_TEST);
-    glShadeModel(GL_SMOOTH);
+static void next_substep(){
+    substep();
+    glutPostRedisplay();
+}
 
-    for(int y=0;y<size;y++){
-        glBegin(GL_TRIANGLE_STRIP);
-        for(int x=0;x<=size;x++){
-            float h0 = (H[y][x]-mn)*inv;
-            float h1 = (H[y+1][x]-mn)*inv;
+static const float* heightColor(float h_norm){
+    static const float pal[4][3] = {
+        {0.05f,0.10f,0.65f}, {0.10f,0.55f,0.18f}, {0.45f,0.42f,0.38f}, {0.95f,0.97f,0.98f}
+    };
+    if(h_norm < 0.30f) return pal[0];
+    else if(h_norm < 0.52f) return pal[1];
+    else if(h_norm < 0.78f) return pal[2];
+    else return pal[3];
+}
 
-            setColor(h0); glVertex3f(x-off, y-off,   H[y][x]*ZSCALE);
-            setColor(h1); glVertex3f(x-off, (y+1)-off, H[y+1][x]*ZSCALE);
+// cella (x,y) scritta dall'ultimo passo?
+static inline int in_pass(int x, int y){
+    if(!pass_step) return 0;
+    int half = pass_step/2;
+    if(pass_phase == 0) return (x&(pass_step-1))==half && (y&(pass_step-1))==half;
+    return !(x&(half-1)) && !(y&(half-1)) && (((x/half)^(y/half))&1);
+}
+
+// mesh in cache, gia' colorata: una strip per riga (strip_len vertici ciascuna)
+// piu' i punti dell'ultimo passo; con RTIN triangoli indicizzati da rtin_idx
+// e strip_count=0. Rifatta solo quando hm, la mesh o la soglia cambiano
+static std::vector<float> mesh_xyz, mesh_rgb, pts_xyz;
+static int strip_len, strip_count;
+
+// ----------------- RTIN -----------------
+// Mesh adattiva a triangoli rettangoli (RTIN) su griglie 2^k+1, come in
+// Martini: ogni triangolo si divide sul punto medio m dell'ipotenusa se
+// l'errore di m supera la soglia. I punti medi sono esattamente i reticoli
+// di diamond (ipotenusa diagonale) e square (ipotenusa sugli assi).
+// rtin_build() calcola una volta l'errore di ogni vertice, dal livello piu'
+// fine al piu' grossolano: scarto fra hm(m) e la media degli estremi
+// dell'ipotenusa, massimizzato con gli errori dei punti medi dei figli
+// (cosi' la mesh non ha crepe). rtin_extract() visita solo i triangoli
+// emessi e i loro antenati: tempo proporzionale all'uscita.
+
+static std::vector<float> rtin_err;        // errore per vertice, row-major
+static std::vector<int> rtin_vid;          // vertice -> indice nella mesh (-1)
+static std::vector<size_t> rtin_used;      // celle di rtin_vid da azzerare
+static std::vector<unsigned> rtin_idx;     // triangoli della mesh RTIN
+
+#define RTIN_E(x,y) rtin_err[(size_t)(y)*(size+1)+(x)]
+
+static void rtin_build(){
+    int n = size+1;
+    rtin_err.assign((size_t)n*n, 0.0f);
+    for(int s=2; s<=size; s*=2){
+        int h = s/2;
+        // punti square: ipotenusa lungo un asse, apici ai due lati
+        for(int y=0; y<=size; y+=h){
+            int horiz = (y/h)%2==0;            // riga dei vertici: ipotenusa orizzontale
+            for(int x = horiz ? h : 0; x<=size; x+=s){
+                int ax = horiz ? x-h : x, ay = horiz ? y : y-h;
+                int bx = horiz ? x+h : x, by = horiz ? y : y+h;
+                float e = fabsf(0.5f*(hm.at(ax,ay)+hm.at(bx,by)) - hm.at(x,y));
+                if(h >= 2)
+                    for(int side=-1; side<=1; side+=2){
+                        int cx = horiz ? x : x+side*h, cy = horiz ? y+side*h : y;
+                        if(cx<0 || cx>size || cy<0 || cy>size) continue;
+                        e = fmaxf(e, fmaxf(RTIN_E((ax+cx)/2,(ay+cy)/2), RTIN_E((bx+cx)/2,(by+cy)/2)));
+                    }
+                RTIN_E(x,y) = e;
+            }
         }
-        glEnd();
+        // punti diamond: diagonale alternata a scacchiera, figli sui 4 lati
+        for(int y=h; y<size; y+=s)
+            for(int x=h; x<size; x+=s){
+                int main_diag = (((x-h)/s + (y-h)/s) & 1) == 0;
+                float a = main_diag ? hm.at(x-h,y-h) : hm.at(x+h,y-h);
+                float b = main_diag ? hm.at(x+h,y+h) : hm.at(x-h,y+h);
+                float e = fabsf(0.5f*(a+b) - hm.at(x,y));
+                e = fmaxf(e, fmaxf(fmaxf(RTIN_E(x-h,y), RTIN_E(x+h,y)), fmaxf(RTIN_E(x,y-h), RTIN_E(x,y+h))));
+                RTIN_E(x,y) = e;
+            }
     }
+    rtin_vid.assign((size_t)n*n, -1);
+    err_dirty = 0;
+}
 
-    glPointSize(4.0f);
-    glBegin(GL_POINTS);
-    glColor3f(1.0f,0.15f,0.15f);
-    for(int y=0;y<=size;y++){
-        for(int x=0;x<=size;x++){
-            if(UPDATED[y][x]){
-                glVertex3f(x-off, y-off, H[y][x]*ZSCALE + 0.5f);
+// aggiunge alla mesh il vertice (x,y) se non c'e' gia'
+static unsigned rtin_vertex(int x, int y, float sc, float off, float inv){
+    int& id = rtin_vid[(size_t)y*(size+1)+x];
+    if(id < 0){
+        float z = hm.at(x,y);
+        const float* c = heightColor((z-h_min)*inv);
+        id = (int)(mesh_xyz.size()/3);
+        rtin_used.push_back((size_t)y*(size+1)+x);
+        mesh_xyz.push_back(x*sc-off); mesh_xyz.push_back(y*sc-off); mesh_xyz.push_back(z*ZSCALE);
+        mesh_rgb.push_back(c[0]); mesh_rgb.push_back(c[1]); mesh_rgb.push_back(c[2]);
+    }
+    return (unsigned)id;
+}
+
+// triangolo a,b,c (ipotenusa a-b): si divide o si emette
+static void rtin_tri(int ax, int ay, int bx, int by, int cx, int cy, float sc, float off, float inv){
+    int mx = (ax+bx)/2, my = (ay+by)/2;
+    if(abs(ax-cx)+abs(ay-cy) > 1 && RTIN_E(mx,my) > rtin_max){
+        rtin_tri(cx,cy, ax,ay, mx,my, sc,off,inv);
+        rtin_tri(bx,by, cx,cy, mx,my, sc,off,inv);
+    } else {
+        rtin_idx.push_back(rtin_vertex(ax,ay,sc,off,inv));
+        rtin_idx.push_back(rtin_vertex(bx,by,sc,off,inv));
+        rtin_idx.push_back(rtin_vertex(cx,cy,sc,off,inv));
+    }
+}
+
+// mesh RTIN per la soglia rtin_max in mesh_xyz/mesh_rgb + rtin_idx
+static void rtin_extract(float sc, float off, float inv){
+    if(err_dirty) rtin_build();
+    mesh_xyz.clear(); mesh_rgb.clear(); rtin_idx.clear();
+    rtin_tri(0,0, size,size, size,0, sc,off,inv);
+    rtin_tri(size,size, 0,0, 0,size, sc,off,inv);
+    // azzera solo gli indici usati: costo proporzionale alla mesh
+    for(size_t i : rtin_used) rtin_vid[i] = -1;
+    rtin_used.clear();
+}
+
+// oltre K=8 si usa una cella ogni ds, scalata alla dimensione di K=8
+static void rebuild_mesh(){
+    float inv = (h_max>h_min)? 1.0f/(h_max-h_min) : 1.0f;
+    int ds = size>256 ? size/256 : 1;
+    float sc = 1.0f/ds, off = size*0.5f*sc;
+
+    if(rtin_on && !mosaic_r){                  // RTIN solo su griglie 2^k+1
+        rtin_extract(sc, off, inv);
+        strip_count = 0;
+    } else {
+        strip_len = 2*(size/ds+1);
+        strip_count = (size+ds-1)/ds;           // il mosaico puo' non essere multiplo di ds
+        mesh_xyz.resize((size_t)strip_len*strip_count*3);
+        mesh_rgb.resize(mesh_xyz.size());
+        float* v = mesh_xyz.data();
+        float* c = mesh_rgb.data();
+        for(int y=0;y<size;y+=ds){
+            for(int x=0;x<=size;x+=ds){
+                int y1 = y+ds < size ? y+ds : size;
+                float z0 = hm.at(x,y), z1 = hm.at(x,y1);
+                const float* c0 = heightColor((z0-h_min)*inv);
+                const float* c1 = heightColor((z1-h_min)*inv);
+                v[0]=x*sc-off; v[1]=y*sc-off;      v[2]=z0*ZSCALE;
+                v[3]=x*sc-off; v[4]=y1*sc-off;     v[5]=z1*ZSCALE;
+                c[0]=c0[0]; c[1]=c0[1]; c[2]=c0[2];
+                c[3]=c1[0]; c[4]=c1[1]; c[5]=c1[2];
+                v+=6; c+=6;
             }
         }
     }
-    glEnd();
+    pts_xyz.clear();
+    // con ds>1 i passi piu' fini della mesh non hanno punti visibili
+    for(int y=0;y<=size;y+=ds)
+        for(int x=0;x<=size;x+=ds)
+            if(in_pass(x,y)){
+                pts_xyz.push_back(x*sc-off);
+                pts_xyz.push_back(y*sc-off);
+                pts_xyz.push_back(hm.at(x,y)*ZSCALE + 0.5f);
+            }
+    mesh_dirty = 0;
+}
+
+static void drawTerrain(){
+    if(mesh_dirty) rebuild_mesh();
+
+    glEnable(GL_DEPTH_TEST);
+    glShadeModel(GL_SMOOTH);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, mesh_xyz.data());
+    glColorPointer(3, GL_FLOAT, 0, mesh_rgb.data());
+    if(rtin_on && !mosaic_r)
+        glDrawElements(GL_TRIANGLES, (int)rtin_idx.size(), GL_UNSIGNED_INT, rtin_idx.data());
+    else
+        for(int r=0;r<strip_count;r++) glDrawArrays(GL_TRIANGLE_STRIP, r*strip_len, strip_len);
+    glDisableClientState(GL_COLOR_ARRAY);
+
+    if(!pts_xyz.empty()){
+        glPointSize(4.0f);
+        glColor3f(1.0f,0.15f,0.15f);
+        glVertexPointer(3, GL_FLOAT, 0, pts_xyz.data());
+        glDrawArrays(GL_POINTS, 0, (int)pts_xyz.size()/3);
+    }
+    glDisableClientState(GL_VERTEX_ARRAY);
 }
 
 static void drawHUD(){
-    char buf[256];
-    sprintf(buf, "[N] step  [A] auto:%s  [R] reset  roughness=%.2f  level=%d  phase=%s  step=%d",
-            autoplay?"on":"off", roughness, iter_level, (phase==0?"DIAMOND":"SQUARE"), step_len);
+    char buf[320];
+    sprintf(buf, "[N] step  [A] auto:%s  [G] tutto  [R] reset  roughness=%.2f  level=%d  phase=%s  step=%d  seed=%u  K=%d %s",
+            autoplay?"on":"off", roughness, iter_level, (phase==0?"DIAMOND":"SQUARE"), step_len, seed,
+            hm.k, hm.tiled?"tile":"row-major");
+    if(mosaic_r) sprintf(buf+strlen(buf), "  mosaico %dx%d", 2*mosaic_r+1, 2*mosaic_r+1);
+    else if(rtin_on) sprintf(buf+strlen(buf), "  [M] RTIN err<%.4f %d tri", rtin_max, (int)rtin_idx.size()/3);
 
     glMatrixMode(GL_PROJECTION); glPushMatrix(); glLoadIdentity(); glOrtho(0,1,0,1,-1,1);
     glMatrixMode(GL_MODELVIEW); glPushMatrix(); glLoadIdentity();
@@ -195,12 +541,20 @@ static void keyboard(unsigned char k,int x,int y){
         case 27: exit(0);
         case 'n': case 'N': next_substep(); break;
         case 'a': case 'A': autoplay = !autoplay; break;
-        case 'r': case 'R': reset_heightmap(); next_substep(); break;
+        case 'r': case 'R':
+            seed = rng_u32(&ui_rng);
+            if(mosaic_r){ build_mosaic(hm.k, mosaic_r); glutPostRedisplay(); break; }
+            reset_heightmap(); next_substep(); break;
+        case 'g': case 'G': while(step_len >= 2) next_substep(); break;  // completa la mappa
         case '[': roughness = fmaxf(0.10f, roughness-0.05f); break;
         case ']': roughness = fminf(0.95f, roughness+0.05f); break;
         case 'w': case 'W': camZ -= 10.0f; break;  // avvicina
         case 's': case 'S': camZ += 10.0f; break;  // allontana
+        case 'm': case 'M': rtin_on = !rtin_on; mesh_dirty = 1; break;
+        case ',': rtin_max = fmaxf(1e-4f, rtin_max/1.5f); mesh_dirty = 1; break;  // piu' triangoli
+        case '.': rtin_max = fminf(1.0f, rtin_max*1.5f); mesh_dirty = 1; break;   // meno triangoli
     }
+    glutPostRedisplay();
 }
 
 static void special(int key,int x,int y){
@@ -208,11 +562,343 @@ static void special(int key,int x,int y){
     if(key==GLUT_KEY_RIGHT) rotY += 4.0f;
     if(key==GLUT_KEY_UP)    rotX -= 4.0f;
     if(key==GLUT_KEY_DOWN)  rotX += 4.0f;
+    glutPostRedisplay();
+}
+
+// -bench: genera la mappa completa a K=8, 11 e 14 con i due layout e
+// confronta i tempi (le quote devono coincidere)
+static int bench_layouts(){
+    static const int ks[3] = {8, 11, 14};
+    seed = 12345u;
+    for(int q=0; q<3; q++){
+        double ms[2]; std::vector<float> ref;
+        for(int t=0; t<2; t++){
+            hm.init(ks[q], t);
+            size = hm.n-1;
+            reset_heightmap();
+            auto c0 = std::chrono::steady_clock::now();
+            while(step_len >= 2) substep();
+            ms[t] = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-c0).count();
+            std::vector<float> rm((size_t)hm.n*hm.n);
+            for(int y=0;y<hm.n;y++) for(int x=0;x<hm.n;x++) rm[(size_t)y*hm.n+x] = hm.at(x,y);
+            if(t==0) ref.swap(rm);
+            else if(rm != ref) printf("K=%d: i layout danno quote diverse!\n", ks[q]);
+        }
+        printf("K=%2d (%5dx%-5d)  row-major %8.1f ms   tile %8.1f ms   x%.2f\n",
+               ks[q], hm.n, hm.n, ms[0], ms[1], ms[0]/ms[1]);
+    }
+    return 0;
+}
+
+// ----------------- Modo out-of-core (-ooc file) -----------------
+// Mappe piu' grandi della RAM: la heightmap sta in un file a tile di
+// 2^ooc_tb x 2^ooc_tb float, mappati in memoria una tile alla volta. Restano
+// mappate al massimo ooc_budget/byte_tile tile (LRU), quindi la memoria
+// residente e' limitata dal budget e non dalla dimensione della mappa.
+// Le quote sono le stesse del modo in RAM (stessi cell_rand e stesse somme).
+//
+// Ordine dei passi, per livello:
+// - step <= tile: un'unica passata per fasce di 2^ooc_tb righe, con lo square
+//   della fascia b-1 subito dopo il diamond della fascia b (i vicini a
+//   distanza half <= tile/2 sono gia' pronti); dentro una fascia si procede
+//   tile per tile. Ogni tile e' caricata O(1) volte per livello, una sola
+//   se il budget tiene ~3 file di tile.
+// - step > tile (i primi livelli): poche celle, al piu' una per tile; diamond
+//   e square in due passate, ~5 tile per cella.
+// Dopo ogni livello le tile sono scaricate su disco e l'intestazione aggiornata
+// (levels_done), cosi' il file e' sempre consistente fino all'ultimo livello.
+
+#define OOC_MAGIC "DSOOC1"
+#define OOC_DATA  65536         // le tile partono dopo l'intestazione (granularita' delle view)
+
+struct OocHeader {
+    char magic[8];
+    int k, tb;                  // griglia 2^k+1, tile 2^tb
+    int levels_done;            // livelli completati
+    unsigned seed;
+    float roughness, h_min, h_max;
+};
+
+static int ooc_tb = 8;                  // tile 256x256 float = 256 KB (>= 7: le view
+                                        // partono a multipli di 64 KB)
+static size_t ooc_budget = 256u<<20;    // memoria per le tile mappate (-mem MB)
+
+struct OocMap {
+    int n, T, tiles_x;
+    size_t tile_bytes;
+    long long loads;                    // tile mappate in totale
+    // Metadati solo per le tile mappate, O(cap) e non O(tile della mappa):
+    // gli slot formano una lista LRU intrusiva (head = usata per ultima) e
+    // una tabella hash a indirizzamento aperto porta da tile a slot.
+    struct Slot { float* p; int tile, prev, next; };
+    std::vector<Slot> slot;             // al piu' cap
+    std::vector<int> hash;              // slot o -1, dimensione potenza di 2 >= 2*cap
+    unsigned hmask;
+    int head, tail;
+    int last_t;                         // ultima tile toccata da at()
+    float* last_p;
+    size_t cap;                         // tile mappabili insieme
+#ifdef _WIN32
+    HANDLE file, fmap;
+#else
+    int fd;
+#endif
+    OocHeader* hdr;
+
+    int open(const char* path, int k){
+        n = (1<<k)+1; T = 1<<ooc_tb; tiles_x = (n+T-1)/T;
+        tile_bytes = (size_t)T*T*sizeof(float);
+        cap = ooc_budget/tile_bytes;
+        if(cap < 9) cap = 9;            // una tile e i suoi vicini
+        loads = 0;
+        slot.clear(); slot.reserve(cap);
+        size_t hs = 16;
+        while(hs < 2*cap) hs <<= 1;
+        hash.assign(hs, -1); hmask = (unsigned)hs-1;
+        head = tail = -1;
+        last_t = -1; last_p = NULL;
+        long long bytes = OOC_DATA + (long long)tiles_x*tiles_x*tile_bytes;
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ|GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(file==INVALID_HANDLE_VALUE) return 0;
+        fmap = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(bytes>>32), (DWORD)bytes, NULL);
+        if(!fmap) return 0;
+#else
+        fd = ::open(path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+        if(fd < 0 || ftruncate(fd, (off_t)bytes) != 0) return 0;
+#endif
+        hdr = (OocHeader*)map(0, OOC_DATA);
+        if(!hdr) return 0;
+        memset(hdr, 0, sizeof(*hdr));
+        memcpy(hdr->magic, OOC_MAGIC, sizeof(OOC_MAGIC));
+        hdr->k = k; hdr->tb = ooc_tb;
+        return 1;
+    }
+    void* map(long long off, size_t len){
+#ifdef _WIN32
+        return MapViewOfFile(fmap, FILE_MAP_ALL_ACCESS, (DWORD)(off>>32), (DWORD)off, len);
+#else
+        void* p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, (off_t)off);
+        return p==MAP_FAILED ? NULL : p;
+#endif
+    }
+    static void unmap(void* p, size_t len){
+#ifdef _WIN32
+        (void)len; UnmapViewOfFile(p);
+#else
+        munmap(p, len);
+#endif
+    }
+    // scarica tutte le tile mappate e l'intestazione
+    void flush(){
+        for(const Slot& s: slot){
+#ifdef _WIN32
+            FlushViewOfFile(s.p, 0);
+#else
+            msync(s.p, tile_bytes, MS_SYNC);
+#endif
+        }
+#ifdef _WIN32
+        FlushViewOfFile(hdr, 0);
+#else
+        msync(hdr, OOC_DATA, MS_SYNC);
+#endif
+    }
+    void close(){
+        flush();
+        for(const Slot& s: slot) unmap(s.p, tile_bytes);
+        slot.clear(); head = tail = -1; last_t = -1;
+        unmap(hdr, OOC_DATA);
+#ifdef _WIN32
+        CloseHandle(fmap); CloseHandle(file);
+#else
+        ::close(fd);
+#endif
+    }
+    inline unsigned home(int t) const { return ((unsigned)t*0x9E3779B1u) & hmask; }
+    // posizione della tile t nella tabella, o della casella vuota dove andrebbe
+    inline unsigned find(int t) const {
+        unsigned i = home(t);
+        while(hash[i] >= 0 && slot[hash[i]].tile != t) i = (i+1) & hmask;
+        return i;
+    }
+    // toglie la casella i (sondaggio lineare: ricompatta senza lapidi)
+    void erase(unsigned i){
+        for(unsigned j=i;;){
+            hash[i] = -1;
+            for(;;){
+                j = (j+1) & hmask;
+                if(hash[j] < 0) return;
+                unsigned h = home(slot[hash[j]].tile);
+                if(((j-h) & hmask) >= ((j-i) & hmask)) break;  // j puo' scendere in i
+            }
+            hash[i] = hash[j]; i = j;
+        }
+    }
+    void unlink(int s){
+        Slot& e = slot[s];
+        if(e.prev >= 0) slot[e.prev].next = e.next; else head = e.next;
+        if(e.next >= 0) slot[e.next].prev = e.prev; else tail = e.prev;
+    }
+    void push_front(int s){
+        slot[s].prev = -1; slot[s].next = head;
+        if(head >= 0) slot[head].prev = s; else tail = s;
+        head = s;
+    }
+    // tile t mappata e in testa all'LRU; se si e' al limite libera la coda
+    float* load(int t){
+        unsigned i = find(t);
+        int s = hash[i];
+        if(s >= 0){
+            if(s != head){ unlink(s); push_front(s); }
+            return slot[s].p;
+        }
+        if(slot.size() >= cap){
+            s = tail;
+            unlink(s);
+            unmap(slot[s].p, tile_bytes);
+            erase(find(slot[s].tile));
+            i = find(t);                // erase puo' aver spostato le caselle
+        } else {
+            s = (int)slot.size();
+            slot.push_back(Slot());
+        }
+        float* p = (float*)map(OOC_DATA + (long long)t*tile_bytes, tile_bytes);
+        if(!p){ fprintf(stderr, "ooc: mappatura della tile %d fallita\n", t); exit(1); }
+        slot[s].p = p; slot[s].tile = t;
+        hash[i] = s;
+        push_front(s);
+        loads++;
+        return p;
+    }
+    // gli accessi ripetuti alla stessa tile non cambiano l'ordine LRU,
+    // quindi basta aggiornarlo quando si cambia tile
+    inline float& at(int x, int y){
+        int t = (y>>ooc_tb)*tiles_x + (x>>ooc_tb);
+        if(t != last_t){ last_p = load(t); last_t = t; }
+        return last_p[((y&(T-1))<<ooc_tb) | (x&(T-1))];
+    }
+};
+
+static OocMap ooc;
+
+// diamond delle righe y in [y0,y1) del passo step, tile per tile
+static void ooc_diamond(int step, float scale, unsigned tag, int y0, int y1, float* mn, float* mx){
+    int half = step/2, T = ooc.T;
+    int ya = y0 <= half ? half : half + (y0-half+step-1)/step*step;
+    for(int x0=0; x0<size; x0+=T){
+        int xa = x0 <= half ? half : half + (x0-half+step-1)/step*step;
+        for(int y=ya; y<y1 && y<size; y+=step)
+            for(int x=xa; x<x0+T && x<size; x+=step){
+                float a = ooc.at(x-half,y-half), b = ooc.at(x+half,y-half);
+                float c = ooc.at(x-half,y+half), d = ooc.at(x+half,y+half);
+                float v = 0.25f*(a+b+c+d) + scale*cell_rand(tag, x, y);
+                ooc.at(x,y) = v;
+                *mn = fminf(*mn, v); *mx = fmaxf(*mx, v);
+            }
+    }
+}
+
+// square delle righe y in [y0,y1) del passo step, tile per tile
+static void ooc_square(int step, float scale, unsigned tag, int y0, int y1, float* mn, float* mx){
+    int half = step/2, T = ooc.T;
+    int ya = (y0+half-1)/half*half;
+    for(int x0=0; x0<=size; x0+=T)
+        for(int y=ya; y<y1 && y<=size; y+=half){
+            int start = ((y/half)%2==0) ? half : 0;
+            int xa = x0 <= start ? start : start + (x0-start+step-1)/step*step;
+            for(int x=xa; x<x0+T && x<=size; x+=step){
+                float sum=0.0f; int cnt=0;
+                if(x-half >= 0)    { sum += ooc.at(x-half,y); cnt++; }
+                if(x+half <= size) { sum += ooc.at(x+half,y); cnt++; }
+                if(y-half >= 0)    { sum += ooc.at(x,y-half); cnt++; }
+                if(y+half <= size) { sum += ooc.at(x,y+half); cnt++; }
+                float v = (cnt? sum/cnt : 0.0f) + scale*cell_rand(tag, x, y);
+                ooc.at(x,y) = v;
+                *mn = fminf(*mn, v); *mx = fmaxf(*mx, v);
+            }
+        }
+}
+
+// genera la mappa 2^k+1 nel file path; ritorna il codice di uscita
+static int run_ooc(const char* path, int k){
+    if(!ooc.open(path, k)){ fprintf(stderr, "ooc: impossibile creare %s\n", path); return 1; }
+    size = ooc.n-1;
+    int T = ooc.T;
+    printf("ooc: %dx%d in %s, %d tile da %zu KB, budget %zu tile\n",
+           ooc.n, ooc.n, path, ooc.tiles_x*ooc.tiles_x, ooc.tile_bytes>>10, ooc.cap);
+    // il file nuovo e' gia' a zero: come reset_heightmap() restano solo gli angoli
+    ooc.at(0,0)       = cell_rand(0, 0, 0);
+    ooc.at(size,0)    = cell_rand(0, size, 0);
+    ooc.at(0,size)    = cell_rand(0, 0, size);
+    ooc.at(size,size) = cell_rand(0, size, size);
+    float mn = 0.0f, mx = 0.0f;
+    for(int i=0;i<4;i++){
+        float v = ooc.at(i&1 ? size : 0, i&2 ? size : 0);
+        mn = fminf(mn, v); mx = fmaxf(mx, v);
+    }
+    ooc.hdr->seed = seed; ooc.hdr->roughness = roughness;
+
+    float scale = 1.0f;
+    int level = 0;
+    for(int step=size; step>=2; step/=2, scale*=roughness, level++){
+        auto c0 = std::chrono::steady_clock::now();
+        long long l0 = ooc.loads;
+        if(step <= T){
+            for(int b=0; b*T<=size+T; b++){     // square in ritardo di una fascia
+                if(b*T <= size) ooc_diamond(step, scale, TAG_DIAMOND(level), b*T, (b+1)*T, &mn, &mx);
+                if(b > 0)       ooc_square(step, scale, TAG_SQUARE(level), (b-1)*T, b*T, &mn, &mx);
+            }
+        } else {
+            ooc_diamond(step, scale, TAG_DIAMOND(level), 0, size, &mn, &mx);
+            ooc_square(step, scale, TAG_SQUARE(level), 0, size+1, &mn, &mx);
+        }
+        ooc.hdr->levels_done = level+1;
+        ooc.hdr->h_min = mn; ooc.hdr->h_max = mx;
+        ooc.flush();
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now()-c0).count();
+        printf("livello %2d/%d  step %6d  %7.2f s  tile caricate %lld\n",
+               level+1, k, step, s, ooc.loads-l0);
+        fflush(stdout);
+    }
+    ooc.close();
+    printf("ooc: fatto, quote in [%f, %f]\n", mn, mx);
+    return 0;
 }
 
 int main(int argc,char**argv){
-    srand((unsigned)time(NULL));
-    reset_heightmap();
+    rng_seed(&ui_rng, (uint64_t)time(NULL), 0);
+    seed = rng_u32(&ui_rng);
+    int k = K_DEF;
+    const char* ooc_path = NULL;
+    for(int a=1; a<argc; a++){
+        if(!strcmp(argv[a],"-bench")) return bench_layouts();
+        if(!strcmp(argv[a],"-tiles")) use_tiles = 1;
+        if(!strcmp(argv[a],"-rtin")) rtin_on = 1;                    // mesh adattiva
+        if(a+1 >= argc) continue;
+        if(!strcmp(argv[a],"-t")) nthreads = atoi(argv[a+1]);        // thread
+        if(!strcmp(argv[a],"-s")) seed = (unsigned)strtoul(argv[a+1], NULL, 10); // seme fisso
+        if(!strcmp(argv[a],"-k")) k = atoi(argv[a+1]);               // griglia 2^k+1
+        if(!strcmp(argv[a],"-ooc")) ooc_path = argv[a+1];            // file della mappa
+        if(!strcmp(argv[a],"-mem")) ooc_budget = (size_t)atoi(argv[a+1])<<20; // budget tile
+        if(!strcmp(argv[a],"-mosaic")) mosaic_r = atoi(argv[a+1]);    // tile senza cuciture
+    }
+    if(ooc_path){                               // niente finestra: genera su file
+        if(k < ooc_tb+1) k = ooc_tb+1;
+        if(k > 20) k = 20;
+        return run_ooc(ooc_path, k);
+    }
+    if(k < 1) k = 1;
+    if(k > 14) k = 14;
+    if(mosaic_r > 0){
+        if(mosaic_r > 8) mosaic_r = 8;
+        while(k > 1 && ((2*mosaic_r+1)<<k) > 16384) k--;   // lato massimo come K=14
+        build_mosaic(k, mosaic_r);
+    } else {
+        hm.init(k, use_tiles);
+        size = hm.n-1;
+        reset_heightmap();
+    }
 
     glutInit(&argc,argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
@@ -223,8 +909,7 @@ int main(int argc,char**argv){
     glutReshapeFunc(reshape);
     glutKeyboardFunc(keyboard);
     glutSpecialFunc(special);
-    glutTimerFunc(120, timer, 0);
-    glutIdleFunc(display);
+    glutTimerFunc(120, timer, 0);   // niente idle: si ridisegna solo quando qualcosa cambia
 
     next_substep(); // subito primo DIAMOND
     glutMainLoop();
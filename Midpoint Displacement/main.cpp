@@ -2,64 +2,77 @@
 #include <vector>
 #include <random>
 #include <set>
-#include <map>
 #include <cmath>
 #include <ctime>
-#include <memory>
+#include <cstdint>
+#include <thread>
+#include <unordered_set>
 #include "GL\glut.h"
+#include "../Common/rng.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MD_SIMD 1	// 法線の計算に AVX2 を使う (実行時に判定)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
-struct pointf {
-	double x,y,z;
-	pointf():x(0),y(0),z(0){}
-	pointf(double x_, double y_):x(x_), y(y_), z(0){}
-	pointf(double x_, double y_, double z_):x(x_), y(y_), z(z_){}
+// 全頂点を格納する配列 (SoA)。頂点は添字で参照し、分割ごとに末尾へ追加される
+struct vertex_arena {
+	vector<float> x, y, z;
+
+	uint32_t add(double x_, double y_, double z_) {
+		x.push_back((float)x_);
+		y.push_back((float)y_);
+		z.push_back((float)z_);
+		return (uint32_t)(x.size()-1);
+	}
+	size_t size() const { return x.size(); }
+	void reserve(size_t n) { x.reserve(n); y.reserve(n); z.reserve(n); }
+	void resize(size_t n) { x.resize(n); y.resize(n); z.resize(n); }
 };
 
+vertex_arena vertices;
+
+// 四角形。法線は compute_vertex_normals() で頂点ごとに求める
 struct quad_mesh {
-	shared_ptr<pointf> points[4];
-	pointf normal;
+	uint32_t points[4];	// vertices の添字
+
+	quad_mesh() {
+		points[0] = points[1] = points[2] = points[3] = 0;
+	}
+};
 
-	quad_mesh()
-		: normal(0, 1, 0) {
-		points[0] = points[1] = points[2] = points[3] = NULL;
+// 辺 (2頂点の添字) -> 中点の頂点の添字 のハッシュ表 (オープンアドレス法)
+// キーは (小さい添字, 大きい添字) を64bitにまとめたもので、向きに依存しない
+const uint64_t EMPTY_EDGE = ~(uint64_t)0;	// 空きスロットのキー
+
+struct edge_hash {
+	vector<uint64_t> keys;
+	vector<uint32_t> values;
+	uint64_t mask;
+	int shift;
+
+	// 辺が最大 n 本入るように空の表を用意する (負荷率 1/2 以下)
+	void reset(size_t n) {
+		size_t cap = 16;
+		shift = 60;
+		while (cap < 2*n) { cap *= 2; shift--; }
+		keys.assign(cap, EMPTY_EDGE);
+		values.resize(cap);
+		mask = cap-1;
 	}
 
+	static uint64_t key(uint32_t a, uint32_t b) {
+		return a<b ? ((uint64_t)a<<32 | b) : ((uint64_t)b<<32 | a);
+	}
 
-	void calculateNormal() {
-		double a11 = this->points[0]->x;
-		double a12 = this->points[0]->y;
-		double a13 = this->points[0]->z;
-		double a21 = this->points[1]->x;
-		double a22 = this->points[1]->y;
-		double a23 = this->points[1]->z;
-		double a31 = this->points[2]->x;
-		double a32 = this->points[2]->y;
-		double a33 = this->points[2]->z;
-		double det = a11*a22*a33+a21*a32*a13+a31*a12*23 - a11*a32*a23-a31*a22*a13-a21*a12*a33;
-
-		double nx, ny, nz;
-		if (fabs(det)<0.01) {
-			nx = nz = 0;
-			ny = 1;
-		} else {
-			nx = (a22*a33 - a23*a32 + a13*a32 - a12*a33 + a12*a23 - a13*a22);
-			ny = (a23*a31 - a21*a33 + a11*a33 - a13*a31 + a13*a21 - a11*a23);
-			nz = (a21*a32 - a22*a31 + a12*a31 - a11*a32 + a11*a22 - a12*a21);
-			double sqrtsum = sqrt(nx*nx+ny*ny+nz*nz);
-			nx /= sqrtsum;
-			ny /= sqrtsum;
-			nz /= sqrtsum;
-			if (ny<0) {
-				nx = -nx;
-				nz = -nz;
-				ny = -ny;
-			}
-		}
-		normal.x = nx;
-		normal.y = ny;
-		normal.z = nz;
+	// 辺 a-b のスロット。keys[slot]==EMPTY_EDGE なら未登録
+	size_t find(uint32_t a, uint32_t b) const {
+		uint64_t k = key(a, b);
+		size_t i = (size_t)((k*0x9E3779B97F4A7C15ull) >> shift);
+		while (keys[i]!=EMPTY_EDGE && keys[i]!=k) i = (i+1) & mask;
+		return i;
 	}
 };
 
@@ -68,134 +81,649 @@ int div_count = 0;
 
 std::vector<quad_mesh> mesh_list;
 
+// 分割レベルの履歴。mesh_undo はより粗いレベルの四角形 (末尾が1つ前のレベル)、
+// mesh_redo は結合で戻したより細かいレベル (末尾が1つ次のレベル)。
+// 結合・再分割はリストの入れ替えだけで、高さは再生成しない。
+// 頂点は全レベル分 vertices に残る (最も細かいレベルの頂点数と同じ)
+std::vector<std::vector<quad_mesh> > mesh_undo, mesh_redo;
+bool mesh_normals_dirty = true;	// mesh_list が変わり、頂点法線が古い
+edge_hash edge_midpoints;
+
 
 GLfloat light0pos[] = { 0.0, 5.0, 5.0, 1.0 };
 GLfloat green[] = { 0.0, 1.0, 1.0, 1.0 };
 GLfloat cameraPos[] = {6.0, 8.0, 10.0};
 int width = 750, height = 600;
 
-// generate a random value according to uniform distribution
-double rand_uniform()
-{
-	return ((double)rand()+1.0)/((double)RAND_MAX+2.0);
-}
+// random stream of the quad-mesh backend (Philox, seeded from the clock in init())
+RngStream mesh_rng;
 
-// generate a random value according to normal distribution
+// generate a random value according to normal distribution (ziggurat)
 double rand_normal(double mu, double sigma)
 {
-	double z = sqrt(-2.0*log(rand_uniform())) * sin(2.0*3.141592*rand_uniform());
-	return mu+sigma*z;
+	return mu+sigma*rng_normal(&mesh_rng);
 }
 
 
 void create_new_meshes_by_midpoint_displacement_algorithm()
 {
+	double sigma = sigma_val;
+	sigma_val /= 2.0;
+	mesh_normals_dirty = true;
+
+	// 既に生成したレベルなら履歴から戻すだけ
+	if (!mesh_redo.empty()) {
+		mesh_undo.push_back(std::move(mesh_list));
+		mesh_list = std::move(mesh_redo.back());
+		mesh_redo.pop_back();
+		return;
+	}
+	mesh_undo.push_back(mesh_list);
 
-	map<shared_ptr<pointf>, map<shared_ptr<pointf>, shared_ptr<pointf> > > processed_points;	// processed_points[p1][p2] => p1とp2の2点から中点変位法によって生成されたポイントを示す
-
-	vector<quad_mesh> new_meshes;
-	vector<quad_mesh>::iterator it,end = mesh_list.end();
+	size_t count = mesh_list.size();
 
-	// initialization
-	for (it=mesh_list.begin(); it!=end; it++)
-	{
-		for (int i=0; i<4; i++)
-		{
-			processed_points[it->points[i]][it->points[(i+1)%4]] = NULL;
-			processed_points[it->points[(i+1)%4]][it->points[i]] = NULL;
-		}
-	}
+	// 中点は辺ごとに1回だけ生成する。辺は最大 4*count 本
+	edge_midpoints.reset(4*count);
+	vertices.reserve(vertices.size() + 3*count + 4);
+	mesh_list.reserve(4*count);
 
 	// すべてのメッシュに対して中点変位法の実行
-	for (it=mesh_list.begin(); it!=end; it++)
+	for (size_t m=0; m<count; m++)
 	{
-		shared_ptr<pointf> new_points[4];
+		quad_mesh &mesh = mesh_list[m];
+		uint32_t new_points[4];
 
 		// 新しい頂点の生成
 		for (int i=0; i<4; i++)
 		{
-			shared_ptr<pointf> p1 = it->points[i];
-			shared_ptr<pointf> p2 = it->points[(i+1)%4];
+			uint32_t p1 = mesh.points[i];
+			uint32_t p2 = mesh.points[(i+1)%4];
+			size_t slot = edge_midpoints.find(p1, p2);
 
-			if (processed_points[p1][p2]) {
+			if (edge_midpoints.keys[slot]!=EMPTY_EDGE) {
 				// 既にこの2点からは新しい頂点が生成されていた
-				new_points[i] = processed_points[p1][p2];
+				new_points[i] = edge_midpoints.values[slot];
 			} else {
 				// 新しい頂点を生成
-				new_points[i] = shared_ptr<pointf>(new pointf((p1->x+p2->x)/2, (p1->y+p2->y)/2 + rand_normal(0, sigma_val)*pow(2, -sigma_val), (p1->z+p2->z)/2));
-				processed_points[p1][p2] = new_points[i];
-				processed_points[p2][p1] = new_points[i];
+				new_points[i] = vertices.add((vertices.x[p1]+vertices.x[p2])/2,
+					(vertices.y[p1]+vertices.y[p2])/2 + rand_normal(0, sigma)*pow(2, -sigma),
+					(vertices.z[p1]+vertices.z[p2])/2);
+				edge_midpoints.keys[slot] = edge_hash::key(p1, p2);
+				edge_midpoints.values[slot] = new_points[i];
 			}
 		}
 
 		// 分割によって生成された4点の中心点を計算
-		shared_ptr<pointf> center_point(new pointf((new_points[0]->x+new_points[1]->x+new_points[2]->x+new_points[3]->x)/4,
-			(new_points[0]->y+new_points[1]->y+new_points[2]->y+new_points[3]->y)/4,
-			(new_points[0]->z+new_points[1]->z+new_points[2]->z+new_points[3]->z)/4));
+		uint32_t center_point = vertices.add(
+			(vertices.x[new_points[0]]+vertices.x[new_points[1]]+vertices.x[new_points[2]]+vertices.x[new_points[3]])/4,
+			(vertices.y[new_points[0]]+vertices.y[new_points[1]]+vertices.y[new_points[2]]+vertices.y[new_points[3]])/4,
+			(vertices.z[new_points[0]]+vertices.z[new_points[1]]+vertices.z[new_points[2]]+vertices.z[new_points[3]])/4);
 
 		quad_mesh new_mesh;
 
-		// 生成された頂点から新しいメッシュを生成
+		// 生成された頂点から新しいメッシュを生成 (元のメッシュの後ろに追加)
 		new_mesh.points[0] = new_points[0];
-		new_mesh.points[1] = it->points[1];
+		new_mesh.points[1] = mesh.points[1];
 		new_mesh.points[2] = new_points[1];
 		new_mesh.points[3] = center_point;
-		new_mesh.calculateNormal();
-		new_meshes.push_back(new_mesh);
+		mesh_list.push_back(new_mesh);
 
 		new_mesh.points[0] = new_points[1];
-		new_mesh.points[1] = it->points[2];
+		new_mesh.points[1] = mesh.points[2];
 		new_mesh.points[2] = new_points[2];
 		new_mesh.points[3] = center_point;
-		new_mesh.calculateNormal();
-		new_meshes.push_back(new_mesh);
+		mesh_list.push_back(new_mesh);
 
 		new_mesh.points[0] = new_points[2];
-		new_mesh.points[1] = it->points[3];
+		new_mesh.points[1] = mesh.points[3];
 		new_mesh.points[2] = new_points[3];
 		new_mesh.points[3] = center_point;
-		new_mesh.calculateNormal();
-		new_meshes.push_back(new_mesh);
+		mesh_list.push_back(new_mesh);
 
-		it->points[1] = new_points[0];
-		it->points[2] = center_point;
-		it->points[3] = new_points[3];
-		it->calculateNormal();
+		mesh.points[1] = new_points[0];
+		mesh.points[2] = center_point;
+		mesh.points[3] = new_points[3];
 
 	}
+}
 
-	for (it=new_meshes.begin(); it!=new_meshes.end(); it++)
-	{
-		mesh_list.push_back(*it);
+// 1つ前のレベルに戻す。今のレベルは再分割用に mesh_redo へ
+void combine_meshes()
+{
+	mesh_redo.push_back(std::move(mesh_list));
+	mesh_list = std::move(mesh_undo.back());
+	mesh_undo.pop_back();
+	sigma_val *= 2;
+	mesh_normals_dirty = true;
+}
+
+// ---- 構造格子バックエンド ----
+// 四角形1枚を一様に分割したメッシュは (2^level+1)^2 の格子そのものなので、
+// 高さだけを格子に持つ。頂点 (i,j) の x,z は格子上の位置から決まり、
+// 辺の中点は (奇数,偶数) と (偶数,奇数)、面の中心は (奇数,奇数) の格子点になる。
+// 近傍は添字計算で求まるので中点の重複検出は不要。
+// 生成した全レベルの格子を残すので (最も細かいレベルの約1.33倍)、
+// 結合と再分割は表示するレベルを切り替えるだけ
+struct height_grid {
+	int level;			// 表示中のレベル (分割回数)
+	int n;				// 一辺の頂点数 = 2^level+1
+	vector<vector<float> > levels;	// レベルごとの高さ。j*n+i (i: x方向, j: z方向)
+
+	float at(int i, int j) const { return levels[level][(size_t)j*n+i]; }
+};
+
+height_grid grid;
+bool use_grid = false;			// true: 構造格子バックエンドで分割・描画 (Gキー)
+uint64_t grid_seed;
+vector<float> grid_xyz, grid_normal;	// 描画用の頂点と頂点法線
+vector<uint32_t> grid_index;			// 描画用の四角形 (4頂点ずつ)
+bool grid_dirty = true;					// 表示レベルが変わり、描画用配列が古い
+
+// fn(r0, r1) を行 [0, rows) の帯に分けて複数スレッドで実行する
+template<class F>
+void parallel_rows(int rows, F fn, int min_rows = 64)
+{
+	int nt = (int)thread::hardware_concurrency();
+	if (nt > rows) nt = rows;
+	if (nt <= 1 || rows < min_rows) {
+		fn(0, rows);
+		return;
 	}
+	vector<thread> th;
+	for (int t=1; t<nt; t++) th.push_back(thread(fn, rows*t/nt, rows*(t+1)/nt));
+	fn(0, rows/nt);
+	for (size_t t=0; t<th.size(); t++) th[t].join();
+}
+
+// 格子点 (i,j) の正規乱数。(seed, 分割回数 level, i, j) を Philox のカウンタにするので
+// スレッドの分け方や計算順序によらず同じ値になる
+double grid_rand_normal(int level, int i, int j, double mu, double sigma)
+{
+	return mu+sigma*rng_normal_at(grid_seed, level, i, j);
+}
+
+// 描画用の頂点・法線・インデックスを作る。法線は高さの中心差分
+void grid_build_buffers()
+{
+	grid_dirty = false;
+	int n = grid.n;
+	float step = 6.0f/(n-1);
+
+	grid_xyz.resize((size_t)n*n*3);
+	grid_normal.resize((size_t)n*n*3);
+	grid_index.resize((size_t)(n-1)*(n-1)*4);
+	parallel_rows(n, [&](int r0, int r1) {
+		for (int j=r0; j<r1; j++) {
+			int j0 = j>0 ? j-1 : j, j1 = j<n-1 ? j+1 : j;
+			for (int i=0; i<n; i++) {
+				int i0 = i>0 ? i-1 : i, i1 = i<n-1 ? i+1 : i;
+				float dx = (grid.at(i1,j)-grid.at(i0,j))/((i1-i0)*step);
+				float dz = (grid.at(i,j1)-grid.at(i,j0))/((j1-j0)*step);
+				float len = sqrtf(dx*dx+1+dz*dz);
+				float *v = &grid_xyz[((size_t)j*n+i)*3], *nv = &grid_normal[((size_t)j*n+i)*3];
+				v[0] = -3+i*step; v[1] = grid.at(i,j); v[2] = -3+j*step;
+				nv[0] = -dx/len; nv[1] = 1/len; nv[2] = -dz/len;
+			}
+			if (j==n-1) continue;
+			// 頂点の順番は quad_mesh と同じ (x0,z0) (x0,z1) (x1,z1) (x1,z0)
+			uint32_t *q = &grid_index[(size_t)j*(n-1)*4];
+			for (int i=0; i<n-1; i++, q+=4) {
+				q[0] = j*n+i;
+				q[1] = (j+1)*n+i;
+				q[2] = (j+1)*n+i+1;
+				q[3] = j*n+i+1;
+			}
+		}
+	});
+}
+
+void grid_reset()
+{
+	grid.level = 0;
+	grid.n = 2;
+	grid.levels.assign(1, vector<float>(4, 0.0f));
+	grid_dirty = true;
+}
+
+// create_new_meshes_by_midpoint_displacement_algorithm() の格子版
+void grid_divide()
+{
+	const height_grid &g = grid;
+	int n = g.n, m = 2*n-1, level = g.level+1;
+	double sigma = sigma_val, scale = pow(2, -sigma_val);
 
 	sigma_val /= 2.0;
+	if (level < (int)g.levels.size()) {	// 生成済み
+		grid.level = level;
+		grid.n = m;
+		grid_dirty = true;
+		return;
+	}
+	vector<float> y((size_t)m*m);
+
+	// 偶数行: 元の頂点と x 方向の辺の中点
+	parallel_rows(n, [&](int r0, int r1) {
+		for (int j=r0; j<r1; j++) {
+			float *row = &y[(size_t)2*j*m];
+			for (int i=0; i<n-1; i++) {
+				row[2*i] = g.at(i,j);
+				row[2*i+1] = (g.at(i,j)+g.at(i+1,j))/2 + grid_rand_normal(level, 2*i+1, 2*j, 0, sigma)*scale;
+			}
+			row[m-1] = g.at(n-1,j);
+		}
+	});
+	// 奇数行: z 方向の辺の中点と、4つの中点の平均である面の中心
+	parallel_rows(n-1, [&](int r0, int r1) {
+		for (int j=r0; j<r1; j++) {
+			float *row = &y[(size_t)(2*j+1)*m];
+			const float *up = row-m, *down = row+m;
+			for (int i=0; i<n; i++)
+				row[2*i] = (g.at(i,j)+g.at(i,j+1))/2 + grid_rand_normal(level, 2*i, 2*j+1, 0, sigma)*scale;
+			for (int i=0; i<n-1; i++)
+				row[2*i+1] = (up[2*i+1]+down[2*i+1]+row[2*i]+row[2*i+2])/4;
+		}
+	});
+
+	grid.levels.push_back(vector<float>());
+	grid.levels.back().swap(y);
+	grid.n = m;
+	grid.level = level;
+	grid_dirty = true;
 }
 
-void combine_meshes()
+// combine_meshes() の格子版
+void grid_combine()
 {
-	int decreased_count = mesh_list.size()/4;
+	grid.level--;
+	grid.n = (grid.n+1)/2;
+	grid_dirty = true;
+	sigma_val *= 2;
+}
 
-	int offset = decreased_count;
+// ---- 四角形メッシュの頂点法線 ----
+// 分割・結合のあと1回、メッシュ全体に対して計算する。各四角形の面法線
+// (対角線の外積なので面積に比例) を4頂点に足し込み、最後に正規化する。
+// 面法線は AVX2 で8枚ずつ求める。足し込み先は normal_x/y/z ひとつで、
+// 頂点を 2^NORMAL_BAND 個ずつの帯に分け、帯ごとに1スレッドが足し込む。
+// そのため面の角を帯ごとに面の番号順に並べておく (固定の大きさの塊に分けて
+// 数え、詰める)。分け方はスレッド数によらないので、作業用の配列の大きさも
+// 足し込みの順序 (= 1スレッドで面の順に足した結果) もスレッド数によらない
+const int NORMAL_BAND = 15;					// 帯の頂点数 2^15 (足し込み先が L2 に収まる)
+const size_t NORMAL_CHUNK = 16384;			// 面の塊の枚数
+vector<float> normal_x, normal_y, normal_z;	// vertices と同じ添字
+vector<float> face_x, face_y, face_z;		// mesh_list と同じ添字の面法線
+vector<uint32_t> corner_face;				// 角の属する面 q (帯ごと、面の番号順)
+vector<uint16_t> corner_vertex;				// その角の頂点 (帯の中での番号)
+vector<uint32_t> corner_pos;				// [帯][塊] ごとの角の数 -> corner_face での位置
+
+typedef void (*face_normal_kernel)(const quad_mesh *quads, size_t q0, size_t q1, float *fx, float *fy, float *fz);
+
+// 四角形 [q0,q1) の面法線 (上向き) を fx,fy,fz[q] に書く
+void face_normals_scalar(const quad_mesh *quads, size_t q0, size_t q1, float *fx, float *fy, float *fz)
+{
+	const float *x = &vertices.x[0], *y = &vertices.y[0], *z = &vertices.z[0];
+	for (size_t q=q0; q<q1; q++) {
+		const uint32_t *p = quads[q].points;
+		float d1x = x[p[2]]-x[p[0]], d1y = y[p[2]]-y[p[0]], d1z = z[p[2]]-z[p[0]];
+		float d2x = x[p[3]]-x[p[1]], d2y = y[p[3]]-y[p[1]], d2z = z[p[3]]-z[p[1]];
+		float nx = d1y*d2z - d1z*d2y;
+		float ny = d1z*d2x - d1x*d2z;
+		float nz = d1x*d2y - d1y*d2x;
+		if (ny<0) {
+			nx = -nx;
+			ny = -ny;
+			nz = -nz;
+		}
+		fx[q] = nx;
+		fy[q] = ny;
+		fz[q] = nz;
+	}
+}
 
-	for (int i=0; i<decreased_count; i++) {
-		// 隣接している4つのメッシュを取得
-		quad_mesh &m1 = mesh_list.at(i);
-		quad_mesh &m2 = mesh_list.at(i+offset);
-		quad_mesh &m3 = mesh_list.at(i+offset+1);
-		quad_mesh &m4 = mesh_list.at(i+offset+2);
+#ifdef MD_SIMD
+// face_normals_scalar() と同じ結果 (同じ演算)
+__attribute__((target("avx2")))
+void face_normals_avx2(const quad_mesh *quads, size_t q0, size_t q1, float *fx, float *fy, float *fz)
+{
+	const float *x = &vertices.x[0], *y = &vertices.y[0], *z = &vertices.z[0];
+	const __m256i stride = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);	// 四角形8枚の同じ角
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	size_t q = q0;
+
+	for (; q+8<=q1; q+=8) {
+		const int *idx = (const int *)quads[q].points;
+		__m256i i0 = _mm256_i32gather_epi32(idx, stride, 4);
+		__m256i i1 = _mm256_i32gather_epi32(idx+1, stride, 4);
+		__m256i i2 = _mm256_i32gather_epi32(idx+2, stride, 4);
+		__m256i i3 = _mm256_i32gather_epi32(idx+3, stride, 4);
+		__m256 d1x = _mm256_sub_ps(_mm256_i32gather_ps(x, i2, 4), _mm256_i32gather_ps(x, i0, 4));
+		__m256 d1y = _mm256_sub_ps(_mm256_i32gather_ps(y, i2, 4), _mm256_i32gather_ps(y, i0, 4));
+		__m256 d1z = _mm256_sub_ps(_mm256_i32gather_ps(z, i2, 4), _mm256_i32gather_ps(z, i0, 4));
+		__m256 d2x = _mm256_sub_ps(_mm256_i32gather_ps(x, i3, 4), _mm256_i32gather_ps(x, i1, 4));
+		__m256 d2y = _mm256_sub_ps(_mm256_i32gather_ps(y, i3, 4), _mm256_i32gather_ps(y, i1, 4));
+		__m256 d2z = _mm256_sub_ps(_mm256_i32gather_ps(z, i3, 4), _mm256_i32gather_ps(z, i1, 4));
+		__m256 nx = _mm256_sub_ps(_mm256_mul_ps(d1y, d2z), _mm256_mul_ps(d1z, d2y));
+		__m256 ny = _mm256_sub_ps(_mm256_mul_ps(d1z, d2x), _mm256_mul_ps(d1x, d2z));
+		__m256 nz = _mm256_sub_ps(_mm256_mul_ps(d1x, d2y), _mm256_mul_ps(d1y, d2x));
+		// ny<0 なら反転
+		__m256 flip = _mm256_and_ps(_mm256_cmp_ps(ny, _mm256_setzero_ps(), _CMP_LT_OQ), sign);
+		_mm256_storeu_ps(fx+q, _mm256_xor_ps(nx, flip));
+		_mm256_storeu_ps(fy+q, _mm256_xor_ps(ny, flip));
+		_mm256_storeu_ps(fz+q, _mm256_xor_ps(nz, flip));
+	}
+	face_normals_scalar(quads, q, q1, fx, fy, fz);
+}
+#endif
+
+face_normal_kernel face_normals = face_normals_scalar;
 
-		// 隣接している4つのメッシュから、分割前のメッシュを復元するために必要な頂点を修得
-		m1.points[1] = m2.points[1];
-		m1.points[2] = m3.points[1];
-		m1.points[3] = m4.points[1];
-		m1.calculateNormal();
+void select_normal_kernel()
+{
+#ifdef MD_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) face_normals = face_normals_avx2;
+#endif
+}
 
-		offset += 2;
+void compute_vertex_normals()
+{
+	size_t nv = vertices.size(), nq = mesh_list.size();
+	size_t nb = (nv>>NORMAL_BAND)+1, nc = (nq+NORMAL_CHUNK-1)/NORMAL_CHUNK;
+	const quad_mesh *quads = &mesh_list[0];
+
+	// 塊ごとに面法線を求め、角の数を帯ごとに数える
+	face_x.resize(nq);
+	face_y.resize(nq);
+	face_z.resize(nq);
+	corner_pos.assign(nb*nc, 0);
+	parallel_rows((int)nc, [&](int c0, int c1) {
+		for (int c=c0; c<c1; c++) {
+			size_t q0 = c*NORMAL_CHUNK, q1 = min(nq, q0+NORMAL_CHUNK);
+			face_normals(quads, q0, q1, &face_x[0], &face_y[0], &face_z[0]);
+			uint32_t *count = &corner_pos[c];
+			for (size_t q=q0; q<q1; q++)
+				for (int k=0; k<4; k++) count[(quads[q].points[k]>>NORMAL_BAND)*nc]++;
+		}
+	}, 1);
+
+	// [帯][塊] の順に累積和をとって詰める。詰めたあと corner_pos[b*nc+c] は
+	// (b,c) の終わりなので、帯 b は [corner_pos[b*nc-1], corner_pos[b*nc+nc-1])
+	uint32_t sum = 0;
+	for (size_t i=0; i<nb*nc; i++) {
+		uint32_t n = corner_pos[i];
+		corner_pos[i] = sum;
+		sum += n;
 	}
+	corner_face.resize(4*nq);
+	corner_vertex.resize(4*nq);
+	parallel_rows((int)nc, [&](int c0, int c1) {
+		for (int c=c0; c<c1; c++) {
+			size_t q0 = c*NORMAL_CHUNK, q1 = min(nq, q0+NORMAL_CHUNK);
+			uint32_t *pos = &corner_pos[c];
+			for (size_t q=q0; q<q1; q++)
+				for (int k=0; k<4; k++) {
+					uint32_t v = quads[q].points[k], i = pos[(v>>NORMAL_BAND)*nc]++;
+					corner_face[i] = (uint32_t)q;
+					corner_vertex[i] = (uint16_t)(v&((1<<NORMAL_BAND)-1));
+				}
+		}
+	}, 1);
+
+	// 帯ごとに足し込んで正規化。どの面にも使われない頂点は上向き
+	normal_x.resize(nv);
+	normal_y.resize(nv);
+	normal_z.resize(nv);
+	parallel_rows((int)nb, [&](int b0, int b1) {
+		for (int b=b0; b<b1; b++) {
+			size_t v0 = (size_t)b<<NORMAL_BAND, v1 = min(nv, v0+((size_t)1<<NORMAL_BAND));
+			for (size_t v=v0; v<v1; v++) normal_x[v] = normal_y[v] = normal_z[v] = 0;
+			uint32_t i0 = b ? corner_pos[b*nc-1] : 0, i1 = corner_pos[b*nc+nc-1];
+			for (uint32_t i=i0; i<i1; i++) {
+				uint32_t q = corner_face[i];
+				size_t v = v0+corner_vertex[i];
+				normal_x[v] += face_x[q];
+				normal_y[v] += face_y[q];
+				normal_z[v] += face_z[q];
+			}
+			for (size_t v=v0; v<v1; v++) {
+				float nx = normal_x[v], ny = normal_y[v], nz = normal_z[v];
+				float len = sqrtf(nx*nx+ny*ny+nz*nz);
+				if (len > 0) {
+					normal_x[v] = nx/len;
+					normal_y[v] = ny/len;
+					normal_z[v] = nz/len;
+				} else {
+					normal_x[v] = normal_z[v] = 0;
+					normal_y[v] = 1;
+				}
+			}
+		}
+	}, 1);
+	mesh_normals_dirty = false;
+}
 
-	sigma_val *= 2;
-	mesh_list.resize(decreased_count);
+// ---- 視点に応じた適応的四分木 ----
+// 格子バックエンドと同じ格子と乱数 (grid_rand_normal) を使うので、節点 (level,i,j) の
+// 角の高さは一様分割したレベル level の格子と一致し、何度細かく・粗くしても同じ地形になる。
+// 1) 上から、投影した変位の大きさが adapt_tau ピクセルを超え、視野に入る節点を分割
+// 2) 下から、辺で接する葉のレベル差が1以下になるよう分割を追加 (restricted quadtree)
+// 3) 葉を中心からの三角形ファンで描く。隣が1段細かい辺には中点を入れるので T 字の割れ目が出ない
+struct quad_node {
+	int level, i, j;	// レベル level の格子でセル (i,j)
+	float h[4];			// 角の高さ。順番は quad_mesh と同じ (x0,z0) (x0,z1) (x1,z1) (x1,z0)
+};
+
+bool use_adaptive = false;		// true: 適応的四分木で描画 (Aキー)
+int adapt_max_level = 14;
+double adapt_tau = 2.0;			// 許容する投影誤差 (ピクセル)
+bool adapt_dirty = true;		// カメラ等が変わり、四分木を作り直す
+vector<unordered_set<uint64_t> > adapt_split;	// レベルごとの分割した節点 (i<<32 | j)
+vector<float> adapt_xyz, adapt_normal;			// 三角形リスト (面法線)
+
+uint64_t node_key(int i, int j) { return (uint64_t)(uint32_t)i<<32 | (uint32_t)j; }
+
+// 4辺の中点と中心の高さ。grid_divide() と同じ乱数・同じ演算順序
+void node_midpoints(const quad_node &q, float mid[4], float &center)
+{
+	double sigma = pow(2, -q.level), scale = pow(2, -sigma);
+	int l = q.level+1, x = 2*q.i, z = 2*q.j;
+	mid[0] = (q.h[0]+q.h[1])/2 + grid_rand_normal(l, x, z+1, 0, sigma)*scale;
+	mid[1] = (q.h[1]+q.h[2])/2 + grid_rand_normal(l, x+1, z+2, 0, sigma)*scale;
+	mid[2] = (q.h[3]+q.h[2])/2 + grid_rand_normal(l, x+2, z+1, 0, sigma)*scale;
+	mid[3] = (q.h[0]+q.h[3])/2 + grid_rand_normal(l, x+1, z, 0, sigma)*scale;
+	center = (mid[3]+mid[1]+mid[0]+mid[2])/4;
+}
+
+void node_children(const quad_node &q, quad_node child[4])
+{
+	float m[4], c;
+	node_midpoints(q, m, c);
+	const float h[4][4] = {
+		{ q.h[0], m[0], c, m[3] },
+		{ m[0], q.h[1], m[1], c },
+		{ c, m[1], q.h[2], m[2] },
+		{ m[3], c, m[2], q.h[3] } };
+	const int di[4] = { 0, 0, 1, 1 }, dj[4] = { 0, 1, 1, 0 };
+	for (int k=0; k<4; k++) {
+		child[k].level = q.level+1;
+		child[k].i = 2*q.i+di[k];
+		child[k].j = 2*q.j+dj[k];
+		for (int v=0; v<4; v++) child[k].h[v] = h[k][v];
+	}
+}
+
+// 節点を分割するか: 次のレベルの変位 (の約2σ) を画面に投影した大きさと視野で判定
+bool node_needs_split(const quad_node &q)
+{
+	if (q.level >= adapt_max_level) return false;
+	double size = 6.0/(1<<q.level), x0 = -3+q.i*size, z0 = -3+q.j*size;
+	double sigma = pow(2, -q.level), amp = 2*sigma*pow(2, -sigma);
+	double y0 = min(min(q.h[0], q.h[1]), min(q.h[2], q.h[3])) - 2*amp;
+	double y1 = max(max(q.h[0], q.h[1]), max(q.h[2], q.h[3])) + 2*amp;
+
+	// カメラ座標系 (gluLookAt と同じ: 原点を注視、y が上)
+	double cl = sqrt(cameraPos[0]*cameraPos[0]+cameraPos[1]*cameraPos[1]+cameraPos[2]*cameraPos[2]);
+	double f[3] = { -cameraPos[0]/cl, -cameraPos[1]/cl, -cameraPos[2]/cl };
+	double sl = sqrt(f[2]*f[2]+f[0]*f[0]);
+	double r[3] = { -f[2]/sl, 0, f[0]/sl };	// f x (0,1,0)
+	double u[3] = { r[1]*f[2]-r[2]*f[1], r[2]*f[0]-r[0]*f[2], r[0]*f[1]-r[1]*f[0] };
+	double ty = tan(15.0*3.141592/180), tx = ty*width/height;
+
+	// 視錐台の同じ面の外側に8頂点すべてがあれば見えない
+	int out[5] = { 0, 0, 0, 0, 0 };
+	for (int k=0; k<8; k++) {
+		double p[3] = { (k&1 ? x0+size : x0)-cameraPos[0], (k&2 ? y1 : y0)-cameraPos[1], (k&4 ? z0+size : z0)-cameraPos[2] };
+		double ze = p[0]*f[0]+p[1]*f[1]+p[2]*f[2];
+		double xe = p[0]*r[0]+p[1]*r[1]+p[2]*r[2];
+		double ye = p[0]*u[0]+p[1]*u[1]+p[2]*u[2];
+		out[0] += ze < 1.0;
+		out[1] += xe > ze*tx;
+		out[2] += xe < -ze*tx;
+		out[3] += ye > ze*ty;
+		out[4] += ye < -ze*ty;
+	}
+	for (int k=0; k<5; k++) if (out[k]==8) return false;
+
+	// 節点の箱までの距離
+	double dx = max(max(x0-cameraPos[0], cameraPos[0]-x0-size), 0.0);
+	double dy = max(max(y0-cameraPos[1], cameraPos[1]-y1), 0.0);
+	double dz = max(max(z0-cameraPos[2], cameraPos[2]-z0-size), 0.0);
+	double dist = max(sqrt(dx*dx+dy*dy+dz*dz), 0.01);
+	return amp/dist * height/(2*ty) > adapt_tau;
+}
+
+void adapt_refine(const quad_node &q)
+{
+	if (!node_needs_split(q)) return;
+	adapt_split[q.level].insert(node_key(q.i, q.j));
+	quad_node child[4];
+	node_children(q, child);
+	for (int k=0; k<4; k++) adapt_refine(child[k]);
+}
+
+void adapt_push(double x, double z, float y)
+{
+	adapt_xyz.push_back((float)x);
+	adapt_xyz.push_back(y);
+	adapt_xyz.push_back((float)z);
+}
+
+// 葉を三角形ファンで出力。隣が分割されている辺には中点を入れる
+void adapt_emit(const quad_node &q)
+{
+	if (q.level < adapt_max_level && adapt_split[q.level].count(node_key(q.i, q.j))) {
+		quad_node child[4];
+		node_children(q, child);
+		for (int k=0; k<4; k++) adapt_emit(child[k]);
+		return;
+	}
+
+	double size = 6.0/(1<<q.level), x0 = -3+q.i*size, z0 = -3+q.j*size;
+	const int ci[4] = { 0, 0, 1, 1 }, cj[4] = { 0, 1, 1, 0 };
+	const int ni[4] = { -1, 0, 1, 0 }, nj[4] = { 0, 1, 0, -1 };	// 辺 k の向こうのセル
+	float mid[4], center;
+	node_midpoints(q, mid, center);
+
+	// 周の頂点 (角と必要な中点)
+	double rx[8], rz[8];
+	float ry[8];
+	int rn = 0, last = (1<<q.level)-1;
+	for (int k=0; k<4; k++) {
+		rx[rn] = x0+ci[k]*size; rz[rn] = z0+cj[k]*size; ry[rn++] = q.h[k];
+		int i = q.i+ni[k], j = q.j+nj[k];
+		if (i<0 || j<0 || i>last || j>last) continue;
+		if (q.level < adapt_max_level && adapt_split[q.level].count(node_key(i, j))) {
+			rx[rn] = x0+(ci[k]+ci[(k+1)%4])*size/2;
+			rz[rn] = z0+(cj[k]+cj[(k+1)%4])*size/2;
+			ry[rn++] = mid[k];
+		}
+	}
+	double cx = x0+size/2, cz = z0+size/2;
+	float cy = (q.h[0]+q.h[1]+q.h[2]+q.h[3])/4;
+	for (int k=0; k<rn; k++) {
+		int k1 = (k+1)%rn;
+		adapt_push(cx, cz, cy);
+		adapt_push(rx[k], rz[k], ry[k]);
+		adapt_push(rx[k1], rz[k1], ry[k1]);
+
+		// 面法線 (上向き)
+		double ax = rx[k]-cx, ay = ry[k]-cy, az = rz[k]-cz;
+		double bx = rx[k1]-cx, by = ry[k1]-cy, bz = rz[k1]-cz;
+		double nx = ay*bz-az*by, ny = az*bx-ax*bz, nz = ax*by-ay*bx;
+		double len = sqrt(nx*nx+ny*ny+nz*nz);
+		if (ny<0) len = -len;
+		for (int v=0; v<3; v++) {
+			adapt_normal.push_back((float)(nx/len));
+			adapt_normal.push_back((float)(ny/len));
+			adapt_normal.push_back((float)(nz/len));
+		}
+	}
+}
+
+void adapt_build()
+{
+	quad_node root;
+	root.level = root.i = root.j = 0;
+	root.h[0] = root.h[1] = root.h[2] = root.h[3] = 0;
+
+	adapt_split.assign(adapt_max_level, unordered_set<uint64_t>());
+	adapt_refine(root);
+
+	// 2:1 の制約: 分割した節点の隣のセルが存在するよう、その親を分割する。
+	// 追加した親の隣は1つ上のレベルを処理するときに満たされる
+	for (int l=adapt_max_level-1; l>0; l--) {
+		int last = (1<<l)-1;
+		vector<uint64_t> nodes(adapt_split[l].begin(), adapt_split[l].end());
+		for (size_t n=0; n<nodes.size(); n++) {
+			int i = (int)(nodes[n]>>32), j = (int)(nodes[n]&0xFFFFFFFFu);
+			const int ni[4] = { i-1, i+1, i, i }, nj[4] = { j, j, j-1, j+1 };
+			for (int k=0; k<4; k++)
+				if (ni[k]>=0 && nj[k]>=0 && ni[k]<=last && nj[k]<=last)
+					adapt_split[l-1].insert(node_key(ni[k]>>1, nj[k]>>1));
+		}
+	}
+
+	adapt_xyz.clear();
+	adapt_normal.clear();
+	adapt_emit(root);
+	adapt_dirty = false;
+}
+
+// back to the undivided base mesh (both backends)
+void reset_meshes()
+{
+	mesh_list.clear();
+	vertices.resize(0);
+	mesh_undo.clear();
+	mesh_redo.clear();
+	mesh_normals_dirty = true;
+
+	// push a default mesh
+	quad_mesh base_mesh;
+	base_mesh.points[0] = vertices.add(-3, 0, -3);
+	base_mesh.points[1] = vertices.add(-3, 0, 3);
+	base_mesh.points[2] = vertices.add(3, 0, 3);
+	base_mesh.points[3] = vertices.add(3, 0, -3);
+	mesh_list.push_back(base_mesh);
+
+	grid_reset();
+	sigma_val = 1;
+	div_count = 0;
+	adapt_dirty = true;
+}
+
+void divide()
+{
+	if (use_grid) grid_divide();
+	else create_new_meshes_by_midpoint_displacement_algorithm();
+	div_count++;
+}
+
+void combine()
+{
+	if (use_grid) grid_combine();
+	else combine_meshes();
+	div_count--;
 }
 
 void setViewportMatrix()
@@ -208,6 +736,8 @@ void setViewportMatrix()
 
 
 
+void update_window_title();
+
 // 描画関数
 void display()
 {
@@ -217,15 +747,49 @@ void display()
 
 	glLightfv(GL_LIGHT0, GL_POSITION, light0pos);
 
+	if (use_adaptive) {
+		if (adapt_dirty) {
+			adapt_build();
+			update_window_title();
+		}
+		glColor3d(0,0,0);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glVertexPointer(3, GL_FLOAT, 0, &adapt_xyz[0]);
+		glNormalPointer(GL_FLOAT, 0, &adapt_normal[0]);
+		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)adapt_xyz.size()/3);
+		glDisableClientState(GL_NORMAL_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glFlush();
+		return;
+	}
+
+	if (use_grid) {
+		if (grid_dirty) grid_build_buffers();
+		glColor3d(0,0,0);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glVertexPointer(3, GL_FLOAT, 0, &grid_xyz[0]);
+		glNormalPointer(GL_FLOAT, 0, &grid_normal[0]);
+		glDrawElements(GL_QUADS, (GLsizei)grid_index.size(), GL_UNSIGNED_INT, &grid_index[0]);
+		glDisableClientState(GL_NORMAL_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glFlush();
+		return;
+	}
+
+	if (mesh_normals_dirty) compute_vertex_normals();
+
 	glBegin(GL_QUADS);
 	for (unsigned int i=0; i<mesh_list.size(); i++)
 	{
 		const quad_mesh &mesh = mesh_list.at(i);
 		for (int j=0; j<4; j++)
 		{
+			uint32_t v = mesh.points[j];
 			glColor3d(0,0,0);
-			glNormal3d(mesh.normal.x, mesh.normal.y, mesh.normal.z);
-			glVertex3d(mesh.points[j]->x, mesh.points[j]->y, mesh.points[j]->z);
+			glNormal3f(normal_x[v], normal_y[v], normal_z[v]);
+			glVertex3f(vertices.x[v], vertices.y[v], vertices.z[v]);
 		}
 	}
 	glEnd();
@@ -236,7 +800,15 @@ void display()
 void update_window_title()
 {
 	char str[1024];
-	sprintf(str, "Fractale mountain - Push N: divide, Push P: combine - Div count: %d, Quad polygon count: %d", div_count, mesh_list.size());
+	if (use_adaptive) {
+		sprintf(str, "Fractale mountain - Push A: uniform, Push +/-: detail, Arrows: camera - Adaptive, error %.2f px, Triangle count: %d",
+			adapt_tau, (int)adapt_xyz.size()/9);
+		glutSetWindowTitle(str);
+		return;
+	}
+	int quads = use_grid ? (grid.n-1)*(grid.n-1) : (int)mesh_list.size();
+	sprintf(str, "Fractale mountain - Push N: divide, Push P: combine, Push 0-9: level, Push R: new, Push G: %s - Div count: %d, Quad polygon count: %d",
+		use_grid ? "grid" : "mesh", div_count, quads);
 	glutSetWindowTitle(str);
 }
 
@@ -249,6 +821,15 @@ void rot_camera(double rot_rad)
 
 	cameraPos[0] = x;
 	cameraPos[2] = z;
+	adapt_dirty = true;
+}
+
+void zoom_camera(double scale)
+{
+	double len = sqrt(cameraPos[0]*cameraPos[0]+cameraPos[1]*cameraPos[1]+cameraPos[2]*cameraPos[2]);
+	if (len*scale < 2.0 || len*scale > 60.0) return;
+	for (int i=0; i<3; i++) cameraPos[i] *= scale;
+	adapt_dirty = true;
 }
 
 void keyboard(unsigned char key, int x, int y)
@@ -257,8 +838,7 @@ void keyboard(unsigned char key, int x, int y)
 	// next
 	case 'n':
 	case 'N':
-		create_new_meshes_by_midpoint_displacement_algorithm();
-		div_count++;
+		divide();
 		update_window_title();
 		glutPostRedisplay();
 		break;
@@ -266,12 +846,54 @@ void keyboard(unsigned char key, int x, int y)
 	// prev
 	case 'p':
 	case 'P':
-		if (mesh_list.size()<4) break;
-		combine_meshes();
-		div_count--;
+		if (div_count==0) break;
+		combine();
+		update_window_title();
+		glutPostRedisplay();
+		break;
+
+	// jump to a level: generated levels are only re-linked, not regenerated
+	case '0': case '1': case '2': case '3': case '4':
+	case '5': case '6': case '7': case '8': case '9':
+		while (div_count > key-'0') combine();
+		while (div_count < key-'0') divide();
 		update_window_title();
 		glutPostRedisplay();
 		break;
+
+	// new random heights (drops the level history)
+	case 'r':
+	case 'R':
+		grid_seed = rng_u32(&mesh_rng);
+		grid_seed = grid_seed<<32 | rng_u32(&mesh_rng);
+		reset_meshes();
+		update_window_title();
+		glutPostRedisplay();
+		break;
+
+	// switch backend (quad mesh / structured grid)
+	case 'g':
+	case 'G':
+		use_grid = !use_grid;
+		reset_meshes();
+		update_window_title();
+		glutPostRedisplay();
+		break;
+
+	// view-dependent adaptive quadtree on/off and its screen-space error
+	case 'a':
+	case 'A':
+		use_adaptive = !use_adaptive;
+		adapt_dirty = true;
+		update_window_title();
+		glutPostRedisplay();
+		break;
+	case '+':
+	case '-':
+		adapt_tau = key=='+' ? adapt_tau/1.5 : adapt_tau*1.5;
+		adapt_dirty = true;
+		glutPostRedisplay();
+		break;
 	}
 }
 
@@ -286,6 +908,14 @@ void keyboardSpecial(int key, int x, int y)
 		rot_camera(-15.0*3.141592/180);
 		glutPostRedisplay();
 		break;
+	case GLUT_KEY_UP:
+		zoom_camera(0.8);
+		glutPostRedisplay();
+		break;
+	case GLUT_KEY_DOWN:
+		zoom_camera(1.25);
+		glutPostRedisplay();
+		break;
 	}
 }
 
@@ -293,6 +923,7 @@ void resize(int w, int h)
 {
 	width = w;
 	height = h;
+	adapt_dirty = true;
 	setViewportMatrix();
 }
 
@@ -301,13 +932,9 @@ void init(void)
 {
 	glClearColor(1.0, 1.0, 1.0f, 1.0f);
 
-	// push a default mesh
-	quad_mesh base_mesh;
-	base_mesh.points[0] = shared_ptr<pointf>(new pointf(-3, 0, -3));
-	base_mesh.points[1] = shared_ptr<pointf>(new pointf(-3, 0, 3));
-	base_mesh.points[2] = shared_ptr<pointf>(new pointf(3, 0, 3));
-	base_mesh.points[3] = shared_ptr<pointf>(new pointf(3, 0, -3));
-	mesh_list.push_back(base_mesh);
+	grid_seed = (uint64_t)time(NULL);
+	select_normal_kernel();
+	reset_meshes();
 
 	// gl settings
 	glEnable(GL_DEPTH_TEST);
@@ -317,7 +944,7 @@ void init(void)
 	glLightfv(GL_LIGHT0, GL_DIFFUSE, green);
 	glLightfv(GL_LIGHT0, GL_SPECULAR, green);
 
-	srand((unsigned)time(NULL));
+	rng_seed(&mesh_rng, (uint64_t)time(NULL), 0);
 }
 
 /***
@@ -1,22 +1,55 @@
-#include <stdlib.h>          // rand, srand
+#include <stdlib.h>          // atoi, exit
+#include <stdio.h>           // snprintf
+#include <string.h>          // strlen, strchr, memcmp
 #include <math.h>            // floorf, tanhf, cosf, sinf
 #include <GL/glut.h>         // OpenGL/GLUT
+#include <thread>            // pool di thread per buildHeight
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <list>              // LRU dei chunk
+#include <unordered_map>
+#include <unordered_set>
+#include "../Common/rng.h"   // Philox: permutazione riproducibile su ogni piattaforma
 
-// --- Dimensioni della mesh (terreno) e della griglia (lattice di Perlin) ---
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PN_SIMD 1            // kernel AVX2/SSE con scelta a runtime
+#include <immintrin.h>       // intrinsics SSE4.1/AVX2
+#endif
+
+// --- Dimensioni della mesh (terreno) ---
 #define MAP_W 120            // colonne della mesh
 #define MAP_H 120            // righe della mesh
-#define G_W   64             // nodi X del lattice
-#define G_H   64             // nodi Y del lattice
+#define TILE  32             // lato dei tile di buildHeight (32x32 float = 4 KB)
+#define MAX_OCT 12           // ottave massime tenute in cache
+
+// --- Mondo a chunk (tasto m) ---
+#define CHUNK 32             // celle per lato di un chunk
+#define CHUNK_N (CHUNK+1)    // campioni per lato (bordo condiviso col vicino)
+#define VIEW_R 4             // chunk disegnati attorno alla camera
+#define PREFETCH_R 6         // chunk richiesti in anticipo davanti alla camera
+#define PREFETCH_THREADS 2   // thread di prefetch in background
 
 // --- Dati principali ---
 static float H[MAP_H][MAP_W];          // heightmap finale
-static float GX[G_H][G_W], GY[G_H][G_W]; // gradienti ai nodi del lattice
+static int   PERM[512];                  // permutazione 0..255 duplicata (hash dei nodi)
+
+// gradienti unitari (8 direzioni), x nella riga 0 e y nella riga 1
+#define GR 0.70710678f
+alignas(64) static const float GRAD[2][8]={
+  { 1,-1, 0, 0, GR,-GR, GR,-GR},
+  { 0, 0, 1,-1, GR, GR,-GR,-GR}
+};
 
 // --- Parametri del rumore ---
 static float s=0.08f;        // scala spaziale (frequenza base)
 static int   oct=7;          // numero di ottave fBm
 static float gain=0.5f;      // attenuazione ampiezza per ottava
 static float lac=2.0f;       // moltiplicatore di frequenza per ottava
+static float shape=0.6f;     // pendenza del tanh di smorzamento
+static float hscale=18.0f;   // scala in altezza
 
 // --- Camera ---
 static float ax=-35;         // rotazione intorno a Y
@@ -26,72 +59,1000 @@ static float dz=120;         // distanza dalla scena
 // --- Flag per mostrare la griglia ---
 static int showGrid=1;
 
+// --- Normali del terreno (riempite da buildHeight insieme ad H) ---
+static float NRM[MAP_H][MAP_W][3];  // pendenza = acos(NRM[j][i][1])
+static int useLight=0;              // 1: illuminazione con NRM (tasto n)
+
+// --- Mondo a chunk ---
+static int    worldMode=0;          // 1: terreno infinito a chunk invece di H
+static float  camX=0, camZ=0;       // posizione della camera nel mondo (celle)
+static size_t chunkBudget=8u<<20;   // memoria massima dei chunk in cache (-m MB)
+
+// --- Thread usati da buildHeight (0 = tutti i core) ---
+static int nThreads=0;
+
+// --- Cache dei layer per ottava (vedi buildHeight) ---
+static float LAYER[MAX_OCT][MAP_H][MAP_W];  // perlin2 di ogni ottava sulla mappa
+static float LAYERDX[MAX_OCT][MAP_H][MAP_W]; // ... e le sue derivate in x
+static float LAYERDY[MAX_OCT][MAP_H][MAP_W]; // ... e in y
+static int   layerCount=0;                  // ottave valide in LAYER
+static int   layerFirst=0;                  // prima ottava del lotto in calcolo
+static float layerS=0, layerLac=0;          // s e lac con cui sono stati campionati
+static int   useCache=1;                    // 0: fbm2_grid diretto, senza LAYER
+
 // ----------------- Funzioni Perlin -----------------
 
 // funzione fade di Perlin (smussa le interpolazioni)
 static inline float fade(float t){ return t*t*t*(t*(t*6-15)+10); }
 
+// derivata della fade: 30 t^2 (t-1)^2
+static inline float dfade(float t){ return 30*t*t*(t*(t-2)+1); }
+
 // interpolazione lineare
 static inline float lerp(float a,float b,float t){ return a+t*(b-a); }
 
-// prodotto scalare tra gradiente e offset locale
-static inline float gdot(int i,int j,float dx,float dy){
-  i=(i%G_W+G_W)%G_W;                 // wrap X
-  j=(j%G_H+G_H)%G_H;                 // wrap Y
-  return GX[j][i]*dx+GY[j][i]*dy;    // grad  offset
+// byte che dipende dal blocco 256x256 del nodo: senza, il pattern si
+// ripeterebbe ogni 256 nodi
+static inline int blockMix(int i,int j){
+  return (int)(((((unsigned)i>>8)*0x9E3779B1u)^(((unsigned)j>>8)*0x85EBCA77u))>>24);
 }
 
-// calcolo del Perlin noise 2D in un punto
-static float perlin2(float x,float y){
+// hash del nodo (i,j) -> indice del gradiente (0..7), dominio illimitato.
+// PERM[i&255] non dipende da j: i nodi (i,j0) e (i,j1) condividono la prima lettura
+static inline int hash2(int i,int j){
+  return PERM[PERM[i&255]+((j^blockMix(i,j))&255)]&7;
+}
+
+// Perlin noise 2D in un punto, con le derivate analitiche (*nx=dn/dx, *ny=dn/dy)
+// ottenute derivando fade() e le lerp; se le derivate non servono il
+// compilatore le elimina (vedi perlin2)
+static inline float perlin2d(float x,float y,float* nx,float* ny){
   int i0=floorf(x), j0=floorf(y);    // nodo basso/sinistro
   int i1=i0+1, j1=j0+1;              // nodo alto/destro
   float tx=x-i0, ty=y-j0;            // offset frazionari
   float u=fade(tx), v=fade(ty);      // fade
-  float d00=gdot(i0,j0,tx,ty);       // contributo (0,0)
-  float d10=gdot(i1,j0,tx-1,ty);     // contributo (1,0)
-  float d01=gdot(i0,j1,tx,ty-1);     // contributo (0,1)
-  float d11=gdot(i1,j1,tx-1,ty-1);   // contributo (1,1)
+  int h00=hash2(i0,j0), h10=hash2(i1,j0), h01=hash2(i0,j1), h11=hash2(i1,j1);
+  float d00=GRAD[0][h00]*tx+GRAD[1][h00]*ty;          // contributo (0,0)
+  float d10=GRAD[0][h10]*(tx-1)+GRAD[1][h10]*ty;      // contributo (1,0)
+  float d01=GRAD[0][h01]*tx+GRAD[1][h01]*(ty-1);      // contributo (0,1)
+  float d11=GRAD[0][h11]*(tx-1)+GRAD[1][h11]*(ty-1);  // contributo (1,1)
   float nx0=lerp(d00,d10,u);         // interp X riga bassa
   float nx1=lerp(d01,d11,u);         // interp X riga alta
+  float du=dfade(tx), dv=dfade(ty);  // derivate della fade
+  float ax0=lerp(GRAD[0][h00],GRAD[0][h10],u)+du*(d10-d00); // d(nx0)/dx
+  float ax1=lerp(GRAD[0][h01],GRAD[0][h11],u)+du*(d11-d01); // d(nx1)/dx
+  float ay0=lerp(GRAD[1][h00],GRAD[1][h10],u);              // d(nx0)/dy
+  float ay1=lerp(GRAD[1][h01],GRAD[1][h11],u);              // d(nx1)/dy
+  *nx=lerp(ax0,ax1,v);
+  *ny=lerp(ay0,ay1,v)+dv*(nx1-nx0);
   return lerp(nx0,nx1,v);            // interp finale su Y
 }
 
-// fBm: somma di pi ottave di Perlin
-static float fbm2(float x,float y){
-  float sum=0, a=1, f=1;
-  for(int o=0;o<oct;o++){            // per ogni ottava
-    sum+=a*perlin2(x*f,y*f);         // somma contributo
-    a*=gain;                         // riduci ampiezza
-    f*=lac;                          // aumenta frequenza
+// calcolo del Perlin noise 2D in un punto
+static float perlin2(float x,float y){
+  float nx,ny;
+  return perlin2d(x,y,&nx,&ny);
+}
+
+// ----------------- fBm specializzato -----------------
+// I cicli sulle ottave (fbm2_grid e blendTile) hanno una versione template<int N>:
+// N>0 sono N ottave con lac=2 fissati a compile time (ciclo srotolato,
+// frequenze costanti); N=0 e' il ciclo generico su oct e lac.
+// Con lac=2 le frequenze 1,2,4.. sono esatte: i due percorsi coincidono bit a bit.
+#define FBM_FIXED 8                  // ottave massime con versione dedicata
+
+// N da usare con i parametri correnti (0 = generico)
+static inline int fbmPreset(void){ return lac==2.0f && oct<=FBM_FIXED ? oct : 0; }
+
+// chiama fn<N>(...) con N=fbmPreset()
+#define FBM_DISPATCH(fn,...) do{ switch(fbmPreset()){                  \
+    case 1: fn<1>(__VA_ARGS__); break; case 2: fn<2>(__VA_ARGS__); break; \
+    case 3: fn<3>(__VA_ARGS__); break; case 4: fn<4>(__VA_ARGS__); break; \
+    case 5: fn<5>(__VA_ARGS__); break; case 6: fn<6>(__VA_ARGS__); break; \
+    case 7: fn<7>(__VA_ARGS__); break; case 8: fn<8>(__VA_ARGS__); break; \
+    default: fn<0>(__VA_ARGS__); } }while(0)
+
+// ----------------- Kernel vettoriale (AVX2/SSE) -----------------
+// Valutano perlin2() su 8 (AVX2) o 4 (SSE4.1) campioni per chiamata, oppure
+// una riga di griglia (perlin2_grid). Le operazioni replicano in ordine quelle
+// scalari (niente FMA), quindi su x86 con matematica SSE il risultato coincide
+// bit a bit con perlin2()/perlin2d().
+
+typedef void (*NoiseKernel)(const float* x,const float* y,float* out,int n);
+// come NoiseKernel, con le derivate in ox/oy
+typedef void (*NoiseKernelD)(const float* x,const float* y,float* out,float* ox,float* oy,int n);
+
+// tabelle per colonna usate da perlin2_grid() (una riga di lattice alla volta)
+struct GridCols {
+  float *tx, *tx1, *u, *du;                  // offset, fade e sua derivata per colonna
+  float *g00x, *g00y, *g10x, *g10y;          // gradienti dei 4 angoli della
+  float *g01x, *g01y, *g11x, *g11y;          // cella di ogni colonna
+};
+
+// le stesse tabelle a partire dalla colonna i (code dei kernel vettoriali)
+static inline GridCols colsAt(const GridCols& c,int i){
+  GridCols r={c.tx+i,c.tx1+i,c.u+i,c.du+i,c.g00x+i,c.g00y+i,c.g10x+i,c.g10y+i,
+              c.g01x+i,c.g01y+i,c.g11x+i,c.g11y+i};
+  return r;
+}
+
+// out[i] = (acc ? out[i] : 0) + a*perlin, su una riga con ty/v costanti
+typedef void (*GridRowKernel)(const GridCols& c,int w,float ty,float ty1,float v,
+                              float a,int acc,float* out);
+// come GridRowKernel, con le derivate pesate af in ox/oy (dv = dfade(ty))
+typedef void (*GridRowKernelD)(const GridCols& c,int w,float ty,float ty1,float v,float dv,
+                               float a,float af,int acc,float* out,float* ox,float* oy);
+
+// versione scalare: stesso ordine delle operazioni di perlin2()
+static void gridRow_scalar(const GridCols& c,int w,float ty,float ty1,float v,
+                           float a,int acc,float* out){
+  for(int i=0;i<w;i++){
+    float d00=c.g00x[i]*c.tx[i]+c.g00y[i]*ty;
+    float d10=c.g10x[i]*c.tx1[i]+c.g10y[i]*ty;
+    float d01=c.g01x[i]*c.tx[i]+c.g01y[i]*ty1;
+    float d11=c.g11x[i]*c.tx1[i]+c.g11y[i]*ty1;
+    float p=lerp(lerp(d00,d10,c.u[i]),lerp(d01,d11,c.u[i]),v);
+    out[i]=acc ? out[i]+a*p : a*p;
+  }
+}
+
+// versione scalare con derivate: stesso ordine delle operazioni di perlin2d()
+static void gridRowD_scalar(const GridCols& c,int w,float ty,float ty1,float v,float dv,
+                            float a,float af,int acc,float* out,float* ox,float* oy){
+  for(int i=0;i<w;i++){
+    float u=c.u[i];
+    float d00=c.g00x[i]*c.tx[i]+c.g00y[i]*ty;
+    float d10=c.g10x[i]*c.tx1[i]+c.g10y[i]*ty;
+    float d01=c.g01x[i]*c.tx[i]+c.g01y[i]*ty1;
+    float d11=c.g11x[i]*c.tx1[i]+c.g11y[i]*ty1;
+    float nx0=lerp(d00,d10,u), nx1=lerp(d01,d11,u);
+    float p=lerp(nx0,nx1,v);
+    float ax0=lerp(c.g00x[i],c.g10x[i],u)+c.du[i]*(d10-d00);
+    float ax1=lerp(c.g01x[i],c.g11x[i],u)+c.du[i]*(d11-d01);
+    float px=lerp(ax0,ax1,v);
+    float py=lerp(lerp(c.g00y[i],c.g10y[i],u),lerp(c.g01y[i],c.g11y[i],u),v)+dv*(nx1-nx0);
+    if(acc){ out[i]+=a*p; ox[i]+=af*px; oy[i]+=af*py; }
+    else   { out[i]=a*p;  ox[i]=af*px;  oy[i]=af*py; }
+  }
+}
+
+// fallback scalare: un campione alla volta
+static void perlin2_batch_scalar(const float* x,const float* y,float* out,int n){
+  for(int k=0;k<n;k++) out[k]=perlin2(x[k],y[k]);
+}
+static void perlin2d_batch_scalar(const float* x,const float* y,float* out,float* ox,float* oy,int n){
+  for(int k=0;k<n;k++) out[k]=perlin2d(x[k],y[k],&ox[k],&oy[k]);
+}
+
+#ifdef PN_SIMD
+
+// --- AVX2: 8 campioni ---
+__attribute__((target("avx2")))
+static inline __m256 fade8(__m256 t){
+  __m256 t3=_mm256_mul_ps(_mm256_mul_ps(t,t),t);
+  __m256 p=_mm256_sub_ps(_mm256_mul_ps(t,_mm256_set1_ps(6)),_mm256_set1_ps(15));
+  p=_mm256_add_ps(_mm256_mul_ps(t,p),_mm256_set1_ps(10));
+  return _mm256_mul_ps(t3,p);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 dfade8(__m256 t){
+  __m256 p=_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(30),t),t);
+  __m256 q=_mm256_add_ps(_mm256_mul_ps(t,_mm256_sub_ps(t,_mm256_set1_ps(2))),_mm256_set1_ps(1));
+  return _mm256_mul_ps(p,q);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 lerp8(__m256 a,__m256 b,__m256 t){
+  return _mm256_add_ps(a,_mm256_mul_ps(t,_mm256_sub_ps(b,a)));
+}
+
+// come hash2(), ma riceve gia' PERM[i&255] (pa) e i prodotti dei bit alti (mi, mj)
+__attribute__((target("avx2")))
+static inline __m256i hash8(__m256i pa,__m256i mi,__m256i mj,__m256i j){
+  __m256i blk=_mm256_srli_epi32(_mm256_xor_si256(mi,mj),24);
+  __m256i key=_mm256_and_si256(_mm256_xor_si256(j,blk),_mm256_set1_epi32(255));
+  return _mm256_i32gather_epi32(PERM,_mm256_add_epi32(pa,key),4);
+}
+
+// gradiente del nodo; gli 8 gradienti stanno in un registro e si
+// selezionano per permutazione (usa i 3 bit bassi di h)
+__attribute__((target("avx2")))
+static inline void grad8(__m256i h,__m256* gx,__m256* gy){
+  *gx=_mm256_permutevar8x32_ps(_mm256_load_ps(GRAD[0]),h);
+  *gy=_mm256_permutevar8x32_ps(_mm256_load_ps(GRAD[1]),h);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 dot8(__m256 gx,__m256 gy,__m256 dx,__m256 dy){
+  return _mm256_add_ps(_mm256_mul_ps(gx,dx),_mm256_mul_ps(gy,dy));
+}
+
+// come perlin2d(); perlin8() scarta le derivate e il compilatore le elimina
+__attribute__((target("avx2")))
+static inline __m256 perlin8d(__m256 x,__m256 y,__m256* nx,__m256* ny){
+  __m256 fx=_mm256_floor_ps(x), fy=_mm256_floor_ps(y);
+  __m256i i0=_mm256_cvttps_epi32(fx), j0=_mm256_cvttps_epi32(fy);
+  __m256i one=_mm256_set1_epi32(1);
+  __m256i i1=_mm256_add_epi32(i0,one), j1=_mm256_add_epi32(j0,one);
+  __m256 tx=_mm256_sub_ps(x,fx), ty=_mm256_sub_ps(y,fy);
+  __m256 tx1=_mm256_sub_ps(tx,_mm256_set1_ps(1)), ty1=_mm256_sub_ps(ty,_mm256_set1_ps(1));
+  __m256 u=fade8(tx), v=fade8(ty);
+  __m256i b=_mm256_set1_epi32(255);
+  __m256i p0=_mm256_i32gather_epi32(PERM,_mm256_and_si256(i0,b),4);
+  __m256i p1=_mm256_i32gather_epi32(PERM,_mm256_and_si256(i1,b),4);
+  __m256i ci=_mm256_set1_epi32((int)0x9E3779B1u), cj=_mm256_set1_epi32((int)0x85EBCA77u);
+  __m256i mi0=_mm256_mullo_epi32(_mm256_srli_epi32(i0,8),ci);
+  __m256i mi1=_mm256_mullo_epi32(_mm256_srli_epi32(i1,8),ci);
+  __m256i mj0=_mm256_mullo_epi32(_mm256_srli_epi32(j0,8),cj);
+  __m256i mj1=_mm256_mullo_epi32(_mm256_srli_epi32(j1,8),cj);
+  __m256 g00x,g00y,g10x,g10y,g01x,g01y,g11x,g11y;
+  grad8(hash8(p0,mi0,mj0,j0),&g00x,&g00y);
+  grad8(hash8(p1,mi1,mj0,j0),&g10x,&g10y);
+  grad8(hash8(p0,mi0,mj1,j1),&g01x,&g01y);
+  grad8(hash8(p1,mi1,mj1,j1),&g11x,&g11y);
+  __m256 d00=dot8(g00x,g00y,tx,ty), d10=dot8(g10x,g10y,tx1,ty);
+  __m256 d01=dot8(g01x,g01y,tx,ty1), d11=dot8(g11x,g11y,tx1,ty1);
+  __m256 nx0=lerp8(d00,d10,u), nx1=lerp8(d01,d11,u);
+  __m256 du=dfade8(tx), dv=dfade8(ty);
+  __m256 ax0=_mm256_add_ps(lerp8(g00x,g10x,u),_mm256_mul_ps(du,_mm256_sub_ps(d10,d00)));
+  __m256 ax1=_mm256_add_ps(lerp8(g01x,g11x,u),_mm256_mul_ps(du,_mm256_sub_ps(d11,d01)));
+  *nx=lerp8(ax0,ax1,v);
+  *ny=_mm256_add_ps(lerp8(lerp8(g00y,g10y,u),lerp8(g01y,g11y,u),v),
+                    _mm256_mul_ps(dv,_mm256_sub_ps(nx1,nx0)));
+  return lerp8(nx0,nx1,v);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 perlin8(__m256 x,__m256 y){
+  __m256 nx,ny;
+  return perlin8d(x,y,&nx,&ny);
+}
+
+// una sola ottava (ottave rade di perlin2_grid)
+__attribute__((target("avx2")))
+static void perlin2_batch_avx2(const float* x,const float* y,float* out,int n){
+  int k=0;
+  for(;k+8<=n;k+=8)
+    _mm256_storeu_ps(out+k,perlin8(_mm256_loadu_ps(x+k),_mm256_loadu_ps(y+k)));
+  if(k<n){
+    float bx[8]={0}, by[8]={0}, bo[8];
+    for(int q=k;q<n;q++){ bx[q-k]=x[q]; by[q-k]=y[q]; }
+    _mm256_storeu_ps(bo,perlin8(_mm256_loadu_ps(bx),_mm256_loadu_ps(by)));
+    for(int q=k;q<n;q++) out[q]=bo[q-k];
+  }
+}
+
+__attribute__((target("avx2")))
+static void perlin2d_batch_avx2(const float* x,const float* y,float* out,float* ox,float* oy,int n){
+  __m256 nx,ny;
+  int k=0;
+  for(;k+8<=n;k+=8){
+    _mm256_storeu_ps(out+k,perlin8d(_mm256_loadu_ps(x+k),_mm256_loadu_ps(y+k),&nx,&ny));
+    _mm256_storeu_ps(ox+k,nx); _mm256_storeu_ps(oy+k,ny);
+  }
+  if(k<n){
+    float bx[8]={0}, by[8]={0}, bo[8], bdx[8], bdy[8];
+    for(int q=k;q<n;q++){ bx[q-k]=x[q]; by[q-k]=y[q]; }
+    _mm256_storeu_ps(bo,perlin8d(_mm256_loadu_ps(bx),_mm256_loadu_ps(by),&nx,&ny));
+    _mm256_storeu_ps(bdx,nx); _mm256_storeu_ps(bdy,ny);
+    for(int q=k;q<n;q++){ out[q]=bo[q-k]; ox[q]=bdx[q-k]; oy[q]=bdy[q-k]; }
+  }
+}
+
+// --- SSE4.1: 4 campioni (senza gather: letture scalari) ---
+__attribute__((target("sse4.1")))
+static inline __m128 fade4(__m128 t){
+  __m128 t3=_mm_mul_ps(_mm_mul_ps(t,t),t);
+  __m128 p=_mm_sub_ps(_mm_mul_ps(t,_mm_set1_ps(6)),_mm_set1_ps(15));
+  p=_mm_add_ps(_mm_mul_ps(t,p),_mm_set1_ps(10));
+  return _mm_mul_ps(t3,p);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 dfade4(__m128 t){
+  __m128 p=_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(30),t),t);
+  __m128 q=_mm_add_ps(_mm_mul_ps(t,_mm_sub_ps(t,_mm_set1_ps(2))),_mm_set1_ps(1));
+  return _mm_mul_ps(p,q);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 lerp4(__m128 a,__m128 b,__m128 t){
+  return _mm_add_ps(a,_mm_mul_ps(t,_mm_sub_ps(b,a)));
+}
+
+// lettura di 4 elementi di PERM (SSE non ha gather)
+__attribute__((target("sse4.1")))
+static inline __m128i perm4(__m128i idx){
+  int id[4]; _mm_storeu_si128((__m128i*)id,idx);
+  return _mm_setr_epi32(PERM[id[0]],PERM[id[1]],PERM[id[2]],PERM[id[3]]);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128i hash4(__m128i pa,__m128i mi,__m128i mj,__m128i j){
+  __m128i blk=_mm_srli_epi32(_mm_xor_si128(mi,mj),24);
+  __m128i key=_mm_and_si128(_mm_xor_si128(j,blk),_mm_set1_epi32(255));
+  return perm4(_mm_add_epi32(pa,key));
+}
+
+__attribute__((target("sse4.1")))
+static inline void grad4(__m128i hv,__m128* gx,__m128* gy){
+  int h[4]; _mm_storeu_si128((__m128i*)h,_mm_and_si128(hv,_mm_set1_epi32(7)));
+  *gx=_mm_setr_ps(GRAD[0][h[0]],GRAD[0][h[1]],GRAD[0][h[2]],GRAD[0][h[3]]);
+  *gy=_mm_setr_ps(GRAD[1][h[0]],GRAD[1][h[1]],GRAD[1][h[2]],GRAD[1][h[3]]);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 dot4(__m128 gx,__m128 gy,__m128 dx,__m128 dy){
+  return _mm_add_ps(_mm_mul_ps(gx,dx),_mm_mul_ps(gy,dy));
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 perlin4d(__m128 x,__m128 y,__m128* nx,__m128* ny){
+  __m128 fx=_mm_floor_ps(x), fy=_mm_floor_ps(y);
+  __m128i i0=_mm_cvttps_epi32(fx), j0=_mm_cvttps_epi32(fy);
+  __m128i one=_mm_set1_epi32(1);
+  __m128i i1=_mm_add_epi32(i0,one), j1=_mm_add_epi32(j0,one);
+  __m128 tx=_mm_sub_ps(x,fx), ty=_mm_sub_ps(y,fy);
+  __m128 tx1=_mm_sub_ps(tx,_mm_set1_ps(1)), ty1=_mm_sub_ps(ty,_mm_set1_ps(1));
+  __m128 u=fade4(tx), v=fade4(ty);
+  __m128i b=_mm_set1_epi32(255);
+  __m128i p0=perm4(_mm_and_si128(i0,b)), p1=perm4(_mm_and_si128(i1,b));
+  __m128i ci=_mm_set1_epi32((int)0x9E3779B1u), cj=_mm_set1_epi32((int)0x85EBCA77u);
+  __m128i mi0=_mm_mullo_epi32(_mm_srli_epi32(i0,8),ci);
+  __m128i mi1=_mm_mullo_epi32(_mm_srli_epi32(i1,8),ci);
+  __m128i mj0=_mm_mullo_epi32(_mm_srli_epi32(j0,8),cj);
+  __m128i mj1=_mm_mullo_epi32(_mm_srli_epi32(j1,8),cj);
+  __m128 g00x,g00y,g10x,g10y,g01x,g01y,g11x,g11y;
+  grad4(hash4(p0,mi0,mj0,j0),&g00x,&g00y);
+  grad4(hash4(p1,mi1,mj0,j0),&g10x,&g10y);
+  grad4(hash4(p0,mi0,mj1,j1),&g01x,&g01y);
+  grad4(hash4(p1,mi1,mj1,j1),&g11x,&g11y);
+  __m128 d00=dot4(g00x,g00y,tx,ty), d10=dot4(g10x,g10y,tx1,ty);
+  __m128 d01=dot4(g01x,g01y,tx,ty1), d11=dot4(g11x,g11y,tx1,ty1);
+  __m128 nx0=lerp4(d00,d10,u), nx1=lerp4(d01,d11,u);
+  __m128 du=dfade4(tx), dv=dfade4(ty);
+  __m128 ax0=_mm_add_ps(lerp4(g00x,g10x,u),_mm_mul_ps(du,_mm_sub_ps(d10,d00)));
+  __m128 ax1=_mm_add_ps(lerp4(g01x,g11x,u),_mm_mul_ps(du,_mm_sub_ps(d11,d01)));
+  *nx=lerp4(ax0,ax1,v);
+  *ny=_mm_add_ps(lerp4(lerp4(g00y,g10y,u),lerp4(g01y,g11y,u),v),
+                 _mm_mul_ps(dv,_mm_sub_ps(nx1,nx0)));
+  return lerp4(nx0,nx1,v);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 perlin4(__m128 x,__m128 y){
+  __m128 nx,ny;
+  return perlin4d(x,y,&nx,&ny);
+}
+
+__attribute__((target("sse4.1")))
+static void perlin2_batch_sse(const float* x,const float* y,float* out,int n){
+  int k=0;
+  for(;k+4<=n;k+=4)
+    _mm_storeu_ps(out+k,perlin4(_mm_loadu_ps(x+k),_mm_loadu_ps(y+k)));
+  if(k<n){
+    float bx[4]={0}, by[4]={0}, bo[4];
+    for(int q=k;q<n;q++){ bx[q-k]=x[q]; by[q-k]=y[q]; }
+    _mm_storeu_ps(bo,perlin4(_mm_loadu_ps(bx),_mm_loadu_ps(by)));
+    for(int q=k;q<n;q++) out[q]=bo[q-k];
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void perlin2d_batch_sse(const float* x,const float* y,float* out,float* ox,float* oy,int n){
+  __m128 nx,ny;
+  int k=0;
+  for(;k+4<=n;k+=4){
+    _mm_storeu_ps(out+k,perlin4d(_mm_loadu_ps(x+k),_mm_loadu_ps(y+k),&nx,&ny));
+    _mm_storeu_ps(ox+k,nx); _mm_storeu_ps(oy+k,ny);
+  }
+  if(k<n){
+    float bx[4]={0}, by[4]={0}, bo[4], bdx[4], bdy[4];
+    for(int q=k;q<n;q++){ bx[q-k]=x[q]; by[q-k]=y[q]; }
+    _mm_storeu_ps(bo,perlin4d(_mm_loadu_ps(bx),_mm_loadu_ps(by),&nx,&ny));
+    _mm_storeu_ps(bdx,nx); _mm_storeu_ps(bdy,ny);
+    for(int q=k;q<n;q++){ out[q]=bo[q-k]; ox[q]=bdx[q-k]; oy[q]=bdy[q-k]; }
+  }
+}
+
+// --- righe di griglia (perlin2_grid): solo letture contigue, niente hash ---
+__attribute__((target("avx2")))
+static void gridRow_avx2(const GridCols& c,int w,float ty,float ty1,float v,
+                         float a,int acc,float* out){
+  __m256 vty=_mm256_set1_ps(ty), vty1=_mm256_set1_ps(ty1), vv=_mm256_set1_ps(v), va=_mm256_set1_ps(a);
+  int i=0;
+  for(;i+8<=w;i+=8){
+    __m256 tx=_mm256_loadu_ps(c.tx+i), tx1=_mm256_loadu_ps(c.tx1+i), u=_mm256_loadu_ps(c.u+i);
+    __m256 d00=_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(c.g00x+i),tx),_mm256_mul_ps(_mm256_loadu_ps(c.g00y+i),vty));
+    __m256 d10=_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(c.g10x+i),tx1),_mm256_mul_ps(_mm256_loadu_ps(c.g10y+i),vty));
+    __m256 d01=_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(c.g01x+i),tx),_mm256_mul_ps(_mm256_loadu_ps(c.g01y+i),vty1));
+    __m256 d11=_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(c.g11x+i),tx1),_mm256_mul_ps(_mm256_loadu_ps(c.g11y+i),vty1));
+    __m256 p=_mm256_mul_ps(va,lerp8(lerp8(d00,d10,u),lerp8(d01,d11,u),vv));
+    _mm256_storeu_ps(out+i,acc ? _mm256_add_ps(_mm256_loadu_ps(out+i),p) : p);
+  }
+  if(i<w) gridRow_scalar(colsAt(c,i),w-i,ty,ty1,v,a,acc,out+i);
+}
+
+__attribute__((target("avx2")))
+static void gridRowD_avx2(const GridCols& c,int w,float ty,float ty1,float v,float dv,
+                          float a,float af,int acc,float* out,float* ox,float* oy){
+  __m256 vty=_mm256_set1_ps(ty), vty1=_mm256_set1_ps(ty1), vv=_mm256_set1_ps(v), vdv=_mm256_set1_ps(dv);
+  __m256 va=_mm256_set1_ps(a), vaf=_mm256_set1_ps(af);
+  int i=0;
+  for(;i+8<=w;i+=8){
+    __m256 tx=_mm256_loadu_ps(c.tx+i), tx1=_mm256_loadu_ps(c.tx1+i);
+    __m256 u=_mm256_loadu_ps(c.u+i), du=_mm256_loadu_ps(c.du+i);
+    __m256 g00x=_mm256_loadu_ps(c.g00x+i), g00y=_mm256_loadu_ps(c.g00y+i);
+    __m256 g10x=_mm256_loadu_ps(c.g10x+i), g10y=_mm256_loadu_ps(c.g10y+i);
+    __m256 g01x=_mm256_loadu_ps(c.g01x+i), g01y=_mm256_loadu_ps(c.g01y+i);
+    __m256 g11x=_mm256_loadu_ps(c.g11x+i), g11y=_mm256_loadu_ps(c.g11y+i);
+    __m256 d00=dot8(g00x,g00y,tx,vty), d10=dot8(g10x,g10y,tx1,vty);
+    __m256 d01=dot8(g01x,g01y,tx,vty1), d11=dot8(g11x,g11y,tx1,vty1);
+    __m256 nx0=lerp8(d00,d10,u), nx1=lerp8(d01,d11,u);
+    __m256 p=_mm256_mul_ps(va,lerp8(nx0,nx1,vv));
+    __m256 ax0=_mm256_add_ps(lerp8(g00x,g10x,u),_mm256_mul_ps(du,_mm256_sub_ps(d10,d00)));
+    __m256 ax1=_mm256_add_ps(lerp8(g01x,g11x,u),_mm256_mul_ps(du,_mm256_sub_ps(d11,d01)));
+    __m256 px=_mm256_mul_ps(vaf,lerp8(ax0,ax1,vv));
+    __m256 py=_mm256_mul_ps(vaf,_mm256_add_ps(lerp8(lerp8(g00y,g10y,u),lerp8(g01y,g11y,u),vv),
+                                              _mm256_mul_ps(vdv,_mm256_sub_ps(nx1,nx0))));
+    if(acc){
+      p=_mm256_add_ps(_mm256_loadu_ps(out+i),p);
+      px=_mm256_add_ps(_mm256_loadu_ps(ox+i),px);
+      py=_mm256_add_ps(_mm256_loadu_ps(oy+i),py);
+    }
+    _mm256_storeu_ps(out+i,p); _mm256_storeu_ps(ox+i,px); _mm256_storeu_ps(oy+i,py);
+  }
+  if(i<w) gridRowD_scalar(colsAt(c,i),w-i,ty,ty1,v,dv,a,af,acc,out+i,ox+i,oy+i);
+}
+
+__attribute__((target("sse4.1")))
+static void gridRow_sse(const GridCols& c,int w,float ty,float ty1,float v,
+                        float a,int acc,float* out){
+  __m128 vty=_mm_set1_ps(ty), vty1=_mm_set1_ps(ty1), vv=_mm_set1_ps(v), va=_mm_set1_ps(a);
+  int i=0;
+  for(;i+4<=w;i+=4){
+    __m128 tx=_mm_loadu_ps(c.tx+i), tx1=_mm_loadu_ps(c.tx1+i), u=_mm_loadu_ps(c.u+i);
+    __m128 d00=_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(c.g00x+i),tx),_mm_mul_ps(_mm_loadu_ps(c.g00y+i),vty));
+    __m128 d10=_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(c.g10x+i),tx1),_mm_mul_ps(_mm_loadu_ps(c.g10y+i),vty));
+    __m128 d01=_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(c.g01x+i),tx),_mm_mul_ps(_mm_loadu_ps(c.g01y+i),vty1));
+    __m128 d11=_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(c.g11x+i),tx1),_mm_mul_ps(_mm_loadu_ps(c.g11y+i),vty1));
+    __m128 p=_mm_mul_ps(va,lerp4(lerp4(d00,d10,u),lerp4(d01,d11,u),vv));
+    _mm_storeu_ps(out+i,acc ? _mm_add_ps(_mm_loadu_ps(out+i),p) : p);
+  }
+  if(i<w) gridRow_scalar(colsAt(c,i),w-i,ty,ty1,v,a,acc,out+i);
+}
+
+__attribute__((target("sse4.1")))
+static void gridRowD_sse(const GridCols& c,int w,float ty,float ty1,float v,float dv,
+                         float a,float af,int acc,float* out,float* ox,float* oy){
+  __m128 vty=_mm_set1_ps(ty), vty1=_mm_set1_ps(ty1), vv=_mm_set1_ps(v), vdv=_mm_set1_ps(dv);
+  __m128 va=_mm_set1_ps(a), vaf=_mm_set1_ps(af);
+  int i=0;
+  for(;i+4<=w;i+=4){
+    __m128 tx=_mm_loadu_ps(c.tx+i), tx1=_mm_loadu_ps(c.tx1+i);
+    __m128 u=_mm_loadu_ps(c.u+i), du=_mm_loadu_ps(c.du+i);
+    __m128 g00x=_mm_loadu_ps(c.g00x+i), g00y=_mm_loadu_ps(c.g00y+i);
+    __m128 g10x=_mm_loadu_ps(c.g10x+i), g10y=_mm_loadu_ps(c.g10y+i);
+    __m128 g01x=_mm_loadu_ps(c.g01x+i), g01y=_mm_loadu_ps(c.g01y+i);
+    __m128 g11x=_mm_loadu_ps(c.g11x+i), g11y=_mm_loadu_ps(c.g11y+i);
+    __m128 d00=dot4(g00x,g00y,tx,vty), d10=dot4(g10x,g10y,tx1,vty);
+    __m128 d01=dot4(g01x,g01y,tx,vty1), d11=dot4(g11x,g11y,tx1,vty1);
+    __m128 nx0=lerp4(d00,d10,u), nx1=lerp4(d01,d11,u);
+    __m128 p=_mm_mul_ps(va,lerp4(nx0,nx1,vv));
+    __m128 ax0=_mm_add_ps(lerp4(g00x,g10x,u),_mm_mul_ps(du,_mm_sub_ps(d10,d00)));
+    __m128 ax1=_mm_add_ps(lerp4(g01x,g11x,u),_mm_mul_ps(du,_mm_sub_ps(d11,d01)));
+    __m128 px=_mm_mul_ps(vaf,lerp4(ax0,ax1,vv));
+    __m128 py=_mm_mul_ps(vaf,_mm_add_ps(lerp4(lerp4(g00y,g10y,u),lerp4(g01y,g11y,u),vv),
+                                        _mm_mul_ps(vdv,_mm_sub_ps(nx1,nx0))));
+    if(acc){
+      p=_mm_add_ps(_mm_loadu_ps(out+i),p);
+      px=_mm_add_ps(_mm_loadu_ps(ox+i),px);
+      py=_mm_add_ps(_mm_loadu_ps(oy+i),py);
+    }
+    _mm_storeu_ps(out+i,p); _mm_storeu_ps(ox+i,px); _mm_storeu_ps(oy+i,py);
   }
-  return sum;
+  if(i<w) gridRowD_scalar(colsAt(c,i),w-i,ty,ty1,v,dv,a,af,acc,out+i,ox+i,oy+i);
+}
+
+#endif // PN_SIMD
+
+// kernel attivi, scelti una volta da selectKernel()
+static NoiseKernel perlin2_batch=perlin2_batch_scalar;
+static NoiseKernelD perlin2d_batch=perlin2d_batch_scalar;
+static GridRowKernel gridRow=gridRow_scalar;
+static GridRowKernelD gridRowD=gridRowD_scalar;
+static const char* kernelName="scalar";
+
+// sceglie i kernel migliori supportati dalla CPU
+static void selectKernel(void){
+#ifdef PN_SIMD
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")){
+    perlin2_batch=perlin2_batch_avx2; gridRow=gridRow_avx2;
+    perlin2d_batch=perlin2d_batch_avx2; gridRowD=gridRowD_avx2;
+    kernelName="AVX2"; return;
+  }
+  if(__builtin_cpu_supports("sse4.1")){
+    perlin2_batch=perlin2_batch_sse; gridRow=gridRow_sse;
+    perlin2d_batch=perlin2d_batch_sse; gridRowD=gridRowD_sse;
+    kernelName="SSE4.1"; return;
+  }
+#endif
+  perlin2_batch=perlin2_batch_scalar; gridRow=gridRow_scalar;
+  perlin2d_batch=perlin2d_batch_scalar; gridRowD=gridRowD_scalar;
+  kernelName="scalar";
+}
+
+// ----------------- Valutazione su griglia regolare -----------------
+// Su una griglia floor/fade dipendono solo dalla colonna (o dalla riga) e i
+// gradienti solo dalla cella del lattice: si calcolano una volta per colonna
+// e per riga di lattice, e ogni campione costa solo le interpolazioni.
+// Le ottave con meno di 2 campioni per cella non hanno nulla da condividere
+// e passano al kernel per campione (stesso risultato bit a bit).
+
+// un'ottava: out[j*stride+i] (+)= a*perlin2((i0+i)*d*f, (j0+j)*d*f);
+// se ox/oy non sono nulli vi somma anche af*(derivate di perlin2 in x e y).
+// La coordinata parte dalla cella intera (float)(i0+i)*d: la stessa cella da
+// due griglie diverse (bordo tra chunk vicini) da' lo stesso campione bit a bit
+static void perlin2_grid(int i0,int j0,float d,float f,int w,int h,
+                         float a,int acc,float* out,int stride,
+                         float af=0,float* ox=nullptr,float* oy=nullptr){
+  static thread_local std::vector<float> buf;      // scratch riusato tra le chiamate
+  static thread_local std::vector<int> ci, p0, p1;
+  static thread_local std::vector<unsigned> mi0, mi1;
+  if((int)ci.size()<w){
+    buf.resize(16*(size_t)w); ci.resize(w); p0.resize(w); p1.resize(w); mi0.resize(w); mi1.resize(w);
+  }
+  float* b=buf.data();
+
+  if(fabsf(d*f)>0.5f){                            // ottava rada: kernel per campione
+    float *xs=b, *ys=b+w, *p=b+2*w, *px=b+3*w, *py=b+4*w;
+    for(int i=0;i<w;i++) xs[i]=(float)(i0+i)*d*f;
+    for(int j=0;j<h;j++){
+      float y=(float)(j0+j)*d*f, *o=out+(size_t)j*stride;
+      for(int i=0;i<w;i++) ys[i]=y;
+      if(!ox){
+        perlin2_batch(xs,ys,p,w);
+        for(int i=0;i<w;i++) o[i]=acc ? o[i]+a*p[i] : a*p[i];
+        continue;
+      }
+      float *odx=ox+(size_t)j*stride, *ody=oy+(size_t)j*stride;
+      perlin2d_batch(xs,ys,p,px,py,w);
+      for(int i=0;i<w;i++){
+        if(acc){ o[i]+=a*p[i]; odx[i]+=af*px[i]; ody[i]+=af*py[i]; }
+        else   { o[i]=a*p[i];  odx[i]=af*px[i];  ody[i]=af*py[i]; }
+      }
+    }
+    return;
+  }
+  GridCols c={b,b+w,b+2*w,b+3*w,b+4*w,b+5*w,b+6*w,b+7*w,b+8*w,b+9*w,b+10*w,b+11*w};
+
+  // tabelle per colonna: cella, offset, fade, prima lettura di PERM, bit alti
+  for(int i=0;i<w;i++){
+    float x=(float)(i0+i)*d*f;
+    ci[i]=floorf(x);
+    c.tx[i]=x-ci[i]; c.tx1[i]=c.tx[i]-1; c.u[i]=fade(c.tx[i]); c.du[i]=dfade(c.tx[i]);
+    p0[i]=PERM[ci[i]&255]; p1[i]=PERM[(ci[i]+1)&255];
+    mi0[i]=((unsigned)ci[i]>>8)*0x9E3779B1u; mi1[i]=((unsigned)(ci[i]+1)>>8)*0x9E3779B1u;
+  }
+
+  int band=0, haveBand=0;
+  for(int j=0;j<h;j++){
+    float y=(float)(j0+j)*d*f;
+    int cj=floorf(y);
+    float ty=y-cj, ty1=ty-1, v=fade(ty);
+    if(!haveBand || cj!=band){          // nuova riga di lattice: gradienti per cella
+      unsigned mj0=((unsigned)cj>>8)*0x85EBCA77u, mj1=((unsigned)(cj+1)>>8)*0x85EBCA77u;
+      for(int i=0;i<w;i++){
+        if(i>0 && ci[i]==ci[i-1]){      // stessa cella della colonna precedente
+          c.g00x[i]=c.g00x[i-1]; c.g00y[i]=c.g00y[i-1]; c.g10x[i]=c.g10x[i-1]; c.g10y[i]=c.g10y[i-1];
+          c.g01x[i]=c.g01x[i-1]; c.g01y[i]=c.g01y[i-1]; c.g11x[i]=c.g11x[i-1]; c.g11y[i]=c.g11y[i-1];
+          continue;
+        }
+        int h00=PERM[p0[i]+((cj    ^(int)((mi0[i]^mj0)>>24))&255)]&7;
+        int h10=PERM[p1[i]+((cj    ^(int)((mi1[i]^mj0)>>24))&255)]&7;
+        int h01=PERM[p0[i]+(((cj+1)^(int)((mi0[i]^mj1)>>24))&255)]&7;
+        int h11=PERM[p1[i]+(((cj+1)^(int)((mi1[i]^mj1)>>24))&255)]&7;
+        c.g00x[i]=GRAD[0][h00]; c.g00y[i]=GRAD[1][h00];
+        c.g10x[i]=GRAD[0][h10]; c.g10y[i]=GRAD[1][h10];
+        c.g01x[i]=GRAD[0][h01]; c.g01y[i]=GRAD[1][h01];
+        c.g11x[i]=GRAD[0][h11]; c.g11y[i]=GRAD[1][h11];
+      }
+      band=cj; haveBand=1;
+    }
+    size_t r=(size_t)j*stride;
+    if(ox) gridRowD(c,w,ty,ty1,v,dfade(ty),a,af,acc,out+r,ox+r,oy+r);
+    else   gridRow(c,w,ty,ty1,v,a,acc,out+r);
+  }
+}
+
+// fBm su griglia: out[j*stride+i] = somma su o di gain^o*perlin2((i0+i)*d*f, (j0+j)*d*f)
+// con f=lac^o; con gx/gy non nulli vi scrive anche le derivate (d/dx di
+// a*perlin(x*f) vale a*f*dperlin)
+template<int N>
+static void fbm2_gridn(int i0,int j0,float d,int w,int h,float* out,int stride,
+                       float* gx,float* gy){
+  float a=1, f=1;
+#pragma GCC unroll 8
+  for(int o=0;o<(N?N:oct);o++){
+    perlin2_grid(i0,j0,d,f,w,h,a,o>0,out,stride,a*f,gx,gy);
+    a*=gain;
+    f*=N?2.0f:lac;
+  }
+}
+static void fbm2_grid(int i0,int j0,float d,int w,int h,float* out,int stride,
+                      float* gx=nullptr,float* gy=nullptr){
+  FBM_DISPATCH(fbm2_gridn,i0,j0,d,w,h,out,stride,gx,gy);
+}
+
+// ----------------- Thread pool (work stealing) -----------------
+// Ogni worker ha la sua coda di task; quando la svuota ruba dal fondo delle
+// code altrui. Il thread chiamante partecipa come worker 0.
+
+struct WorkQueue {
+  std::mutex m;
+  std::deque<int> q;
+};
+
+class TilePool {
+public:
+  explicit TilePool(int n): queues(n<1?1:n) {
+    for(int w=1;w<(int)queues.size();w++) workers.emplace_back(&TilePool::loop,this,w);
+  }
+  ~TilePool(){
+    { std::lock_guard<std::mutex> lk(m); quit=true; }
+    wake.notify_all();
+    for(auto& t: workers) t.join();
+  }
+  int size() const { return (int)queues.size(); }
+
+  // esegue fn(0..ntasks-1) sul pool e ritorna quando sono tutti finiti
+  void run(int ntasks,void (*fn)(int)){
+    if(ntasks<=0) return;
+    pending=ntasks;
+    { std::lock_guard<std::mutex> lk(m); job=fn; }
+    for(int t=0;t<ntasks;t++){          // distribuzione round-robin iniziale
+      WorkQueue& wq=queues[t%queues.size()];
+      std::lock_guard<std::mutex> lk(wq.m);
+      wq.q.push_back(t);
+    }
+    { std::lock_guard<std::mutex> lk(m); gen++; }
+    wake.notify_all();
+    drain(0);
+    std::unique_lock<std::mutex> lk(m);
+    done.wait(lk,[this]{ return pending.load()==0; });
+  }
+
+private:
+  // prende un task: prima dalla propria coda, poi ruba dalle altre
+  bool next(int self,int* task){
+    int n=(int)queues.size();
+    for(int k=0;k<n;k++){
+      WorkQueue& wq=queues[(self+k)%n];
+      std::lock_guard<std::mutex> lk(wq.m);
+      if(wq.q.empty()) continue;
+      if(k==0){ *task=wq.q.front(); wq.q.pop_front(); }
+      else    { *task=wq.q.back();  wq.q.pop_back();  }
+      return true;
+    }
+    return false;
+  }
+
+  void drain(int self){
+    int t;
+    while(next(self,&t)){
+      job(t);
+      if(pending.fetch_sub(1)==1){
+        std::lock_guard<std::mutex> lk(m);
+        done.notify_all();
+      }
+    }
+  }
+
+  void loop(int self){
+    unsigned seen=0;
+    for(;;){
+      {
+        std::unique_lock<std::mutex> lk(m);
+        wake.wait(lk,[&]{ return quit || gen!=seen; });
+        if(quit) return;
+        seen=gen;
+      }
+      drain(self);
+    }
+  }
+
+  std::vector<WorkQueue> queues;
+  std::vector<std::thread> workers;
+  std::mutex m;
+  std::condition_variable wake, done;
+  void (*job)(int)=nullptr;
+  unsigned gen=0;
+  std::atomic<int> pending{0};
+  bool quit=false;
+};
+
+static TilePool* pool=nullptr;
+
+// (ri)crea il pool con n thread (n<=0: uno per core)
+static void setThreads(int n){
+  if(n<=0) n=(int)std::thread::hardware_concurrency();
+  if(n<=0) n=1;
+  nThreads=n;
+  delete pool;
+  pool=new TilePool(n);
 }
 
 // ----------------- Generazione dati -----------------
 
-// costruisce i gradienti del lattice
+// costruisce la permutazione che assegna i gradienti ai nodi del lattice
 static void buildGrad(unsigned seed){
-  srand(seed);
-  for(int j=0;j<G_H;j++){
-    for(int i=0;i<G_W;i++){
-      float a=(rand()/(float)RAND_MAX)*6.2831853f; // angolo casuale
-      GX[j][i]=cosf(a);                            // componente X
-      GY[j][i]=sinf(a);                            // componente Y
+  RngStream rng;
+  rng_seed(&rng,seed,0);
+  for(int k=0;k<256;k++) PERM[k]=k;
+  for(int k=255;k>0;k--){                        // Fisher-Yates
+    int r=(int)rng_below(&rng,k+1);
+    int t=PERM[k]; PERM[k]=PERM[r]; PERM[r]=t;
+  }
+  for(int k=0;k<256;k++) PERM[256+k]=PERM[k];    // copia: niente wrap su PERM[a+j]
+  layerCount=0;                                  // layer da ricampionare
+}
+
+// ----------------- Cache dei layer per ottava -----------------
+// LAYER[o] contiene perlin2() dell'ottava o su tutta la mappa. Cambiare gain,
+// shape o hscale richiede solo la somma pesata (blendTile); aumentare oct
+// calcola solo le ottave nuove; cambiare lac invalida tutte le ottave tranne la 0.
+// La somma segue lo stesso ordine di fbm2_grid(): con o senza cache (tasto c)
+// H e' identica bit a bit.
+
+#define TILES_X ((MAP_W+TILE-1)/TILE)
+#define TILES   (TILES_X*((MAP_H+TILE-1)/TILE))
+
+// estremi del tile t
+static inline void tileRect(int t,int* i0,int* j0,int* w,int* h){
+  *i0=(t%TILES_X)*TILE; *j0=(t/TILES_X)*TILE;
+  *w=MAP_W-*i0<TILE ? MAP_W-*i0 : TILE;
+  *h=MAP_H-*j0<TILE ? MAP_H-*j0 : TILE;
+}
+
+// campiona un tile di un'ottava; task = (ottava-layerFirst)*TILES + tile
+// (i tile sono fissi: il risultato non dipende dal numero di thread)
+static void layerTile(int t){
+  int o=layerFirst+t/TILES, i0,j0,w,h;
+  tileRect(t%TILES,&i0,&j0,&w,&h);
+  float f=1;
+  for(int k=0;k<o;k++) f*=lac;     // stessa frequenza di fbm2_grid()
+  perlin2_grid(i0,j0,s,f,w,h,1,0,&LAYER[o][j0][i0],MAP_W,
+               1,&LAYERDX[o][j0][i0],&LAYERDY[o][j0][i0]);
+}
+
+// altezza e normale di una cella da fBm e derivate (in unita' di noise):
+// H=tanh(shape*n)*hscale, dH/di = hscale*shape*(1-t^2)*s*dn/dx
+static inline void shadeCell(float n,float gx,float gy,float* h,float* nrm){
+  float t=tanhf(shape*n), k=hscale*shape*(1-t*t)*s;
+  float nx=-k*gx, nz=-k*gy, r=1.0f/sqrtf(nx*nx+1+nz*nz);
+  *h=t*hscale;
+  nrm[0]=nx*r; nrm[1]=r; nrm[2]=nz*r;
+}
+
+// senza cache: fBm di un tile direttamente in H
+static void gridTile(int t){
+  int i0,j0,w,h;
+  tileRect(t,&i0,&j0,&w,&h);
+  float n[TILE*TILE], gx[TILE*TILE], gy[TILE*TILE];
+  fbm2_grid(i0,j0,s,w,h,n,TILE,gx,gy);
+  for(int j=0;j<h;j++)
+    for(int i=0;i<w;i++) shadeCell(n[j*TILE+i],gx[j*TILE+i],gy[j*TILE+i],&H[j0+j][i0+i],NRM[j0+j][i0+i]);
+}
+
+// somma pesata dei layer + smorzamento su un tile, con gli stessi pesi e lo
+// stesso ordine di fbm2_grid(); per N>0 le ottave sono srotolate dentro il
+// ciclo sulle colonne, che resta vettorizzabile e non rilegge sum/sx/sy
+template<int N>
+static void blendTileN(int t){
+  int i0,j0,w,h;
+  tileRect(t,&i0,&j0,&w,&h);
+  float a[MAX_OCT], af[MAX_OCT], aa=1, f=1;
+  for(int o=0;o<(N?N:oct);o++){
+    a[o]=aa; af[o]=aa*f;
+    aa*=gain;
+    f*=N?2.0f:lac;
+  }
+  for(int j=j0;j<j0+h;j++){
+    float sum[TILE]={0}, sx[TILE]={0}, sy[TILE]={0};
+    if(N){
+      for(int i=0;i<w;i++){
+        float s0=0, s1=0, s2=0;
+#pragma GCC unroll 8
+        for(int o=0;o<N;o++){
+          s0+=a[o]*LAYER[o][j][i0+i]; s1+=af[o]*LAYERDX[o][j][i0+i]; s2+=af[o]*LAYERDY[o][j][i0+i];
+        }
+        sum[i]=s0; sx[i]=s1; sy[i]=s2;
+      }
+    } else {
+      for(int o=0;o<oct;o++){
+        const float *L=&LAYER[o][j][i0], *Lx=&LAYERDX[o][j][i0], *Ly=&LAYERDY[o][j][i0];
+        for(int i=0;i<w;i++){ sum[i]+=a[o]*L[i]; sx[i]+=af[o]*Lx[i]; sy[i]+=af[o]*Ly[i]; }
+      }
     }
+    for(int i=0;i<w;i++) shadeCell(sum[i],sx[i],sy[i],&H[j][i0+i],NRM[j][i0+i]);
   }
 }
+static void blendTile(int t){ FBM_DISPATCH(blendTileN,t); }
 
-// costruisce la heightmap da fBm
+// costruisce la heightmap: campiona sul pool solo le ottave mancanti, poi le somma
 static void buildHeight(void){
-  for(int j=0;j<MAP_H;j++){
-    for(int i=0;i<MAP_W;i++){
-      float h=fbm2(i*s,j*s);       // valore fBm
-      h=tanhf(0.6f*h);             // smorzamento
-      H[j][i]=h*18.0f;             // scala in altezza
-    }
+  if(!pool) setThreads(nThreads);
+  if(!useCache){ layerCount=0; pool->run(TILES,gridTile); return; }
+  if(layerS!=s) layerCount=0;                    // cambia la scala: tutto da rifare
+  if(layerLac!=lac && layerCount>1) layerCount=1; // l'ottava 0 non dipende da lac
+  layerS=s; layerLac=lac;
+  if(layerCount<oct){
+    layerFirst=layerCount;
+    pool->run((oct-layerCount)*TILES,layerTile);
+    layerCount=oct;
   }
+  pool->run(TILES,blendTile);
 }
 
+// ----------------- Mondo a chunk -----------------
+// Il terreno e' diviso in chunk di CHUNK celle generati su richiesta con gli
+// stessi parametri di fbm2_grid (la cella (i,j) del mondo campiona i*s, j*s, come H):
+// il bordo condiviso da due chunk vicini ha gli stessi campioni (vedi -seams).
+// I chunk pronti stanno in una cache LRU entro chunkBudget byte; quelli davanti
+// alla camera sono generati in anticipo da PREFETCH_THREADS thread.
+// La cache e' toccata solo dal thread principale: i worker consegnano i chunk
+// in una lista 'ready' che update() travasa nella cache.
+
+struct Chunk {
+  int cx, cz;                       // coordinate del chunk
+  unsigned used;                    // ultimo frame in cui e' stato disegnato
+  float h[CHUNK_N][CHUNK_N];        // quote
+  float nrm[CHUNK_N][CHUNK_N][3];   // normali (vedi shadeCell)
+};
+
+static inline uint64_t chunkKey(int cx,int cz){
+  return (uint64_t)(uint32_t)cx<<32 | (uint32_t)cz;
+}
+
+// campiona un chunk (chiamabile da qualsiasi thread)
+static void genChunk(Chunk* c){
+  static thread_local float n[CHUNK_N*CHUNK_N], gx[CHUNK_N*CHUNK_N], gy[CHUNK_N*CHUNK_N];
+  fbm2_grid(c->cx*CHUNK,c->cz*CHUNK,s,CHUNK_N,CHUNK_N,n,CHUNK_N,gx,gy);
+  for(int j=0;j<CHUNK_N;j++)
+    for(int i=0;i<CHUNK_N;i++){
+      int k=j*CHUNK_N+i;
+      shadeCell(n[k],gx[k],gy[k],&c->h[j][i],c->nrm[j][i]);
+    }
+}
+
+class ChunkWorld {
+public:
+  ChunkWorld(){
+    for(int w=0;w<PREFETCH_THREADS;w++) workers.emplace_back(&ChunkWorld::loop,this);
+  }
+  ~ChunkWorld(){
+    { std::lock_guard<std::mutex> lk(m); quit=true; }
+    wake.notify_all();
+    for(auto& t: workers) t.join();
+    clear();
+  }
+  int count() const { return (int)lru.size(); }
+
+  // chunk (cx,cz) per il frame corrente; se manca lo genera subito
+  Chunk* get(int cx,int cz){
+    auto it=map.find(chunkKey(cx,cz));
+    if(it!=map.end()){
+      lru.splice(lru.begin(),lru,it->second);   // in testa: usato ora
+      (*it->second)->used=frame;
+      return *it->second;
+    }
+    Chunk* c=new Chunk;
+    c->cx=cx; c->cz=cz; c->used=frame;
+    genChunk(c);
+    insert(c);
+    return c;
+  }
+
+  // inizio frame: accoglie i chunk del prefetch, richiede quelli davanti
+  // alla camera (cx,cz) in direzione (fx,fz) e rientra nel budget
+  void update(int cx,int cz,float fx,float fz){
+    frame++;
+    std::vector<Chunk*> got;
+    bool more;
+    {
+      std::lock_guard<std::mutex> lk(m);
+      got.swap(ready);
+      for(uint64_t k: queue) pending.erase(k);  // richieste vecchie: si rifanno
+      queue.clear();
+      for(int r=1;r<=PREFETCH_R;r++)            // per anelli, dal piu' vicino
+        for(int dz=-r;dz<=r;dz++)
+          for(int dx=-r;dx<=r;dx++){
+            if(abs(dx)!=r && abs(dz)!=r) continue;
+            if(r>VIEW_R && dx*fx+dz*fz<=0) continue;  // fuori vista: solo davanti
+            uint64_t k=chunkKey(cx+dx,cz+dz);
+            if(map.count(k) || pending.count(k)) continue;
+            pending.insert(k); queue.push_back(k);
+          }
+      more=!queue.empty();
+    }
+    if(more) wake.notify_all();
+    for(Chunk* c: got){
+      if(map.count(chunkKey(c->cx,c->cz))) delete c;   // gia' generato da get()
+      else { c->used=0; insert(c); }
+    }
+  }
+
+  // sospende i worker (da chiamare prima di cambiare i parametri del rumore)
+  void pause(){
+    std::unique_lock<std::mutex> lk(m);
+    paused=true;
+    idle.wait(lk,[this]{ return busy==0; });
+  }
+  void resume(){
+    { std::lock_guard<std::mutex> lk(m); paused=false; }
+    wake.notify_all();
+  }
+
+  // scarta tutti i chunk (parametri cambiati); i worker devono essere in pausa
+  void clear(){
+    for(Chunk* c: lru) delete c;
+    lru.clear(); map.clear();
+    std::lock_guard<std::mutex> lk(m);
+    for(Chunk* c: ready) delete c;
+    ready.clear(); queue.clear(); pending.clear();
+  }
+
+private:
+  void insert(Chunk* c){
+    lru.push_front(c);
+    map[chunkKey(c->cx,c->cz)]=lru.begin();
+    // rientra nel budget dalla coda, senza toccare i chunk di questo frame
+    while(lru.size()*sizeof(Chunk)>chunkBudget && lru.back()->used!=frame){
+      Chunk* old=lru.back();
+      map.erase(chunkKey(old->cx,old->cz));
+      lru.pop_back();
+      delete old;
+    }
+  }
+
+  void loop(){
+    std::unique_lock<std::mutex> lk(m);
+    for(;;){
+      wake.wait(lk,[this]{ return quit || (!paused && !queue.empty()); });
+      if(quit) return;
+      uint64_t k=queue.front(); queue.pop_front();
+      busy++;
+      lk.unlock();
+      Chunk* c=new Chunk;
+      c->cx=(int)(uint32_t)(k>>32); c->cz=(int)(uint32_t)k;
+      genChunk(c);
+      lk.lock();
+      busy--;
+      pending.erase(k);
+      ready.push_back(c);
+      if(busy==0) idle.notify_all();
+    }
+  }
+
+  // solo thread principale
+  std::list<Chunk*> lru;                                   // testa = piu' recente
+  std::unordered_map<uint64_t,std::list<Chunk*>::iterator> map;
+  unsigned frame=0;
+  // condivisi con i worker (sotto m)
+  std::mutex m;
+  std::condition_variable wake, idle;
+  std::deque<uint64_t> queue;                              // chunk da generare
+  std::unordered_set<uint64_t> pending;                    // in coda o in calcolo
+  std::vector<Chunk*> ready;                               // generati, da inserire
+  int busy=0;
+  bool paused=false, quit=false;
+  std::vector<std::thread> workers;
+};
+
+static ChunkWorld* world=nullptr;
+
 // ----------------- Rendering -----------------
 
 // colore in base alla quota
@@ -103,11 +1064,13 @@ static void colorH(float h){
   else          glColor3f(0.9,0.9,0.9);
 }
 
-// disegna la griglia del lattice sotto il terreno
+// disegna sotto il terreno la griglia del lattice (ottava base)
 static void drawGrid(void){
   if(!showGrid) return;
   float X0=-(MAP_W*0.5f), Z0=-(MAP_H*0.5f), Y=-12.0f;
-  float sx=(float)MAP_W/(G_W-1), sz=(float)MAP_H/(G_H-1);
+  float sx=1.0f/s, sz=1.0f/s;       // passo del lattice in celle della mesh
+  int gw=(int)((MAP_W-1)*s)+1;     // nodi visibili in X
+  int gh=(int)((MAP_H-1)*s)+1;     // nodi visibili in Y
 
   glDisable(GL_DEPTH_TEST);         // disegno indipendente dal depth
   glEnable(GL_BLEND);               // attiva trasparenza
@@ -116,22 +1079,22 @@ static void drawGrid(void){
   glLineWidth(1);
   glColor4f(0.1,0.1,0.1,0.75);
   glBegin(GL_LINES);
-  for(int j=0;j<G_H;j++){           // linee orizzontali
+  for(int j=0;j<gh;j++){           // linee orizzontali
     float z=Z0+j*sz;
-    glVertex3f(X0,Y,z); glVertex3f(X0+MAP_W,Y,z);
+    glVertex3f(X0,Y,z); glVertex3f(X0+MAP_W-1,Y,z);
   }
-  for(int i=0;i<G_W;i++){           // linee verticali
+  for(int i=0;i<gw;i++){           // linee verticali
     float x=X0+i*sx;
-    glVertex3f(x,Y,Z0); glVertex3f(x,Y,Z0+MAP_H);
+    glVertex3f(x,Y,Z0); glVertex3f(x,Y,Z0+MAP_H-1);
   }
   glEnd();
 
   glPointSize(3);
   glColor4f(0.05,0.05,0.05,0.85);
   glBegin(GL_POINTS);               // nodi come punti
-  for(int j=0;j<G_H;j++){
+  for(int j=0;j<gh;j++){
     float z=Z0+j*sz;
-    for(int i=0;i<G_W;i++){ float x=X0+i*sx; glVertex3f(x,Y,z); }
+    for(int i=0;i<gw;i++){ float x=X0+i*sx; glVertex3f(x,Y,z); }
   }
   glEnd();
 
@@ -143,16 +1106,54 @@ static void drawGrid(void){
 static void drawTerrain(void){
   glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
   glEnable(GL_CULL_FACE); glCullFace(GL_BACK);
+  if(useLight){                  // luce direzionale, colore da glColor
+    static const float dir[4]={-0.5f,1.0f,0.3f,0.0f};
+    glEnable(GL_LIGHTING); glEnable(GL_LIGHT0);
+    glLightfv(GL_LIGHT0,GL_POSITION,dir);
+    glEnable(GL_COLOR_MATERIAL); glColorMaterial(GL_FRONT_AND_BACK,GL_AMBIENT_AND_DIFFUSE);
+  }
   for(int j=0;j<MAP_H-1;j++){
     glBegin(GL_TRIANGLE_STRIP);
     for(int i=0;i<MAP_W;i++){
       float h1=H[j+1][i], h0=H[j][i];
-      colorH(h1); glVertex3f(i-(MAP_W*0.5f),h1,(j+1)-(MAP_H*0.5f));
-      colorH(h0); glVertex3f(i-(MAP_W*0.5f),h0,j-(MAP_H*0.5f));
+      colorH(h1); glNormal3fv(NRM[j+1][i]); glVertex3f(i-(MAP_W*0.5f),h1,(j+1)-(MAP_H*0.5f));
+      colorH(h0); glNormal3fv(NRM[j][i]);   glVertex3f(i-(MAP_W*0.5f),h0,j-(MAP_H*0.5f));
     }
     glEnd();
   }
   glDisable(GL_CULL_FACE);
+  glDisable(GL_LIGHTING);
+}
+
+// disegna i chunk entro VIEW_R dalla camera, nelle coordinate del mondo
+static void drawWorld(void){
+  float fx=sinf(ax*(float)M_PI/180), fz=-cosf(ax*(float)M_PI/180);  // direzione di vista
+  int ccx=(int)floorf(camX/CHUNK), ccz=(int)floorf(camZ/CHUNK);
+  world->update(ccx,ccz,fx,fz);
+  glPolygonMode(GL_FRONT_AND_BACK,GL_FILL);
+  glEnable(GL_CULL_FACE); glCullFace(GL_BACK);
+  if(useLight){
+    static const float dir[4]={-0.5f,1.0f,0.3f,0.0f};
+    glEnable(GL_LIGHTING); glEnable(GL_LIGHT0);
+    glLightfv(GL_LIGHT0,GL_POSITION,dir);
+    glEnable(GL_COLOR_MATERIAL); glColorMaterial(GL_FRONT_AND_BACK,GL_AMBIENT_AND_DIFFUSE);
+  }
+  for(int dz=-VIEW_R;dz<=VIEW_R;dz++)
+    for(int dx=-VIEW_R;dx<=VIEW_R;dx++){
+      Chunk* c=world->get(ccx+dx,ccz+dz);
+      float X0=(float)c->cx*CHUNK, Z0=(float)c->cz*CHUNK;
+      for(int j=0;j<CHUNK;j++){
+        glBegin(GL_TRIANGLE_STRIP);
+        for(int i=0;i<CHUNK_N;i++){
+          float h1=c->h[j+1][i], h0=c->h[j][i];
+          colorH(h1); glNormal3fv(c->nrm[j+1][i]); glVertex3f(X0+i,h1,Z0+j+1);
+          colorH(h0); glNormal3fv(c->nrm[j][i]);   glVertex3f(X0+i,h0,Z0+j);
+        }
+        glEnd();
+      }
+    }
+  glDisable(GL_CULL_FACE);
+  glDisable(GL_LIGHTING);
 }
 
 // ----------------- Callback GLUT -----------------
@@ -164,8 +1165,13 @@ static void display(void){
   glTranslatef(0,-10,-dz);       // sposta camera
   glRotatef(ay,1,0,0);           // inclina
   glRotatef(ax,0,1,0);           // ruota
-  drawTerrain();
-  drawGrid();
+  if(worldMode){
+    glTranslatef(-camX,0,-camZ);   // camera nel mondo
+    drawWorld();
+  }else{
+    drawTerrain();
+    drawGrid();
+  }
   glutSwapBuffers();
 }
 
@@ -177,6 +1183,37 @@ static void reshape(int w,int h){
   gluPerspective(60.0,(float)w/h,0.1,1000);
 }
 
+// titolo finestra con kernel e numero di thread
+static void updateTitle(void){
+  char title[256];
+  snprintf(title,sizeof(title),"Perlin Landscape + Lattice Grid [%s, %d thread%s]  oct=%d gain=%.2f lac=%.2f shape=%.2f h=%.0f",
+           kernelName,nThreads,useCache?", cache":"",oct,gain,lac,shape,hscale);
+  if(worldMode){
+    size_t len=strlen(title);
+    snprintf(title+len,sizeof(title)-len,"  world (%.0f,%.0f) %d chunk",camX,camZ,world->count());
+  }
+  glutSetWindowTitle(title);
+}
+
+// tasti dei parametri fBm
+static int isParamKey(unsigned char k){ return k && strchr("[],.lLkKhH",k)!=nullptr; }
+
+// applica un tasto dei parametri fBm
+static void editParam(unsigned char k){
+  switch(k){
+    case '[': gain=fmaxf(0.05f,gain-0.05f); break;
+    case ']': gain=fminf(0.95f,gain+0.05f); break;
+    case ',': if(oct>1) oct--; break;
+    case '.': if(oct<MAX_OCT) oct++; break;
+    case 'l': lac=fmaxf(1.1f,lac-0.1f); break;
+    case 'L': lac=fminf(3.0f,lac+0.1f); break;
+    case 'k': shape=fmaxf(0.1f,shape-0.05f); break;
+    case 'K': shape=fminf(2.0f,shape+0.05f); break;
+    case 'h': hscale=fmaxf(1.0f,hscale-1.0f); break;
+    case 'H': hscale=fminf(40.0f,hscale+1.0f); break;
+  }
+}
+
 // tastiera
 static void keyboard(unsigned char k,int x,int y){
   if(k==27) exit(0);             // ESC
@@ -184,27 +1221,86 @@ static void keyboard(unsigned char k,int x,int y){
   if(k=='w') ay+=5; if(k=='s') ay-=5;
   if(k=='+') dz-=5; if(k=='-') dz+=5;
   if(k=='g'||k=='G') showGrid=!showGrid;
+  if(k=='n'||k=='N') useLight=!useLight;
+  if(k=='m'||k=='M'){ worldMode=!worldMode; updateTitle(); }
+  if(k=='t'&&nThreads>1){ setThreads(nThreads-1); buildHeight(); updateTitle(); }
+  if(k=='T'){ setThreads(nThreads+1); buildHeight(); updateTitle(); }
+  if(k=='c'||k=='C'){ useCache=!useCache; buildHeight(); updateTitle(); }
+  // parametri fBm: ricalcolo incrementale tramite la cache dei layer;
+  // i worker del mondo leggono i parametri, quindi restano fermi durante la
+  // modifica (solo per questi tasti: la camera non ferma il prefetch)
+  if(isParamKey(k)){
+    world->pause();
+    editParam(k); buildHeight(); world->clear();
+    world->resume();
+    updateTitle();
+  }
+  glutPostRedisplay();
+}
+
+// frecce: movimento della camera nel mondo a chunk
+static void special(int k,int x,int y){
+  if(!worldMode) return;
+  float fx=sinf(ax*(float)M_PI/180), fz=-cosf(ax*(float)M_PI/180), step=4;
+  if(k==GLUT_KEY_UP)   { camX+=fx*step; camZ+=fz*step; }
+  if(k==GLUT_KEY_DOWN) { camX-=fx*step; camZ-=fz*step; }
+  if(k==GLUT_KEY_LEFT) { camX+=fz*step; camZ-=fx*step; }
+  if(k==GLUT_KEY_RIGHT){ camX-=fz*step; camZ+=fx*step; }
+  updateTitle();
   glutPostRedisplay();
 }
 
+// ----------------- Verifica dei bordi (-seams N) -----------------
+// genera N chunk sparsi (anche a coordinate negative) con i vicini a destra e
+// sotto, e controlla che quote e normali del bordo condiviso coincidano bit a bit
+static int checkSeams(int n){
+  Chunk *c=new Chunk, *r=new Chunk, *d=new Chunk;
+  int bad=0;
+  for(int p=0;p<n;p++){
+    c->cx=(int)(p*7919u%20001)-10000; c->cz=(int)(p*104729u%20001)-10000;
+    r->cx=c->cx+1; r->cz=c->cz;
+    d->cx=c->cx;   d->cz=c->cz+1;
+    genChunk(c); genChunk(r); genChunk(d);
+    int ok=1;
+    for(int k=0;k<CHUNK_N;k++){
+      ok&=!memcmp(&c->h[k][CHUNK],&r->h[k][0],sizeof(float)) && !memcmp(c->nrm[k][CHUNK],r->nrm[k][0],sizeof(c->nrm[0][0]));
+      ok&=!memcmp(&c->h[CHUNK][k],&d->h[0][k],sizeof(float)) && !memcmp(c->nrm[CHUNK][k],d->nrm[0][k],sizeof(c->nrm[0][0]));
+    }
+    if(!ok && bad++<10) printf("bordo diverso: chunk (%d,%d)\n",c->cx,c->cz);
+  }
+  printf("seams: %d chunk su %d con bordi diversi\n",bad,n);
+  delete c; delete r; delete d;
+  return bad!=0;
+}
+
 // ----------------- Init + main -----------------
 
 static void init(void){
   glEnable(GL_DEPTH_TEST);
   glClearColor(0.6,0.8,1.0,1.0);
+  selectKernel();
   buildGrad(12345u);
   buildHeight();
+  world=new ChunkWorld;
 }
 
 int main(int argc,char** argv){
+  for(int a=1;a+1<argc;a++)            // -seams N: verifica i bordi di N chunk ed esce
+    if(!strcmp(argv[a],"-seams")){ selectKernel(); buildGrad(12345u); return checkSeams(atoi(argv[a+1])); }
   glutInit(&argc,argv);
   glutInitDisplayMode(GLUT_DOUBLE|GLUT_RGB|GLUT_DEPTH);
   glutInitWindowSize(900,700);
   glutCreateWindow("Perlin Landscape + Lattice Grid");
+  for(int a=1;a+1<argc;a++)            // -t N: thread per buildHeight
+    if(argv[a][0]=='-'&&argv[a][1]=='t'&&!argv[a][2]) nThreads=atoi(argv[a+1]);
+  for(int a=1;a+1<argc;a++)            // -m MB: memoria per i chunk del mondo
+    if(argv[a][0]=='-'&&argv[a][1]=='m'&&!argv[a][2]) chunkBudget=(size_t)atoi(argv[a+1])<<20;
   init();
+  updateTitle();
   glutDisplayFunc(display);
   glutReshapeFunc(reshape);
   glutKeyboardFunc(keyboard);
+  glutSpecialFunc(special);
   glutMainLoop();
   return 0;
 }